@@ -1,12 +1,61 @@
 #include "Cell.hpp"
+#include "Profiler.hpp"
+#include "Serialize.hpp"
+#include "SpatialIndex.hpp"
 
+// Genome hash is a sum of per-byte contributions, byteMix[value] * positionMul[position] (mod 2^64).
+// Changing a byte only needs its old and new value to update the hash.
+struct GenomeHashTables {
+	std::array<uint64_t, 256> byteMix {};
+	std::array<uint64_t, 127> positionMul {};
+};
+
+static constexpr uint64_t splitmix64(uint64_t& state) {
+	uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+static constexpr GenomeHashTables makeGenomeHashTables() {
+	GenomeHashTables tables;
+	uint64_t state = 0;
+	for (auto& val : tables.byteMix) {
+		val = splitmix64(state);
+	}
+	for (auto& val : tables.positionMul) {
+		// Odd multipliers are invertible, so no position loses bits
+		val = splitmix64(state) | 1;
+	}
+	return tables;
+}
+
+static constexpr auto genomeHashTables = makeGenomeHashTables();
+
+static constexpr uint64_t genomeHashTerm(size_t pos, uint8_t val) {
+	return genomeHashTables.byteMix[val] * genomeHashTables.positionMul[pos];
+}
+
+// One of 8 directions that gets closest to `to`
+static Direction directionTowards(const Point& from, const Point& to) {
+	// Indexed by sign of dy and dx, plus one
+	static constexpr Direction table[3][3] = {
+		{Direction::UPLEFT, Direction::UP, Direction::UPRIGHT},
+		{Direction::LEFT, Direction::UP, Direction::RIGHT},
+		{Direction::DOWNLEFT, Direction::DOWN, Direction::DOWNRIGHT}
+	};
+	auto sign = [](size_t a, size_t b) { return (a > b) ? 2 : ((a < b) ? 0 : 1); };
+	return table[sign(to.y, from.y)][sign(to.x, from.x)];
+}
+
+template<typename Geometry>
 uint8_t Cell::regRead(uint8_t reg, const Point& pos) const {
 	reg = reg & 0xF;
 	switch (reg) {
 	case 0:
 		return energy;
 	case 1:
-		return field.lightMap[pos.toArrayIdx()];
+		return field.light(pos.toArrayIdx<Geometry>());
 	case 2:
 		return age / 4;
 	default:
@@ -20,7 +69,89 @@ void Cell::regWrite(uint8_t reg, uint8_t val) {
 	if (reg > 2) gRegs[reg - 3] = val;
 }
 
+// Instructions that only touch cell itself, shared by interpreter and loop detection
+template<typename Geometry>
+void Cell::stepLocal(uint8_t cmd, const Point& pos) {
+	auto getIR0 = [this]() { return gRegs[2]; };
+	auto getIR1 = [this]() { return gRegs[3]; };
+	auto setoreg = [this](uint8_t val) { gRegs[1] = val; };
+
+	++localStreak;
+	switch (cmd) {
+	case 0: // HIB
+		energy_usage = 1;
+		return;
+	case 1:   // JMP
+	case 2: { // RJMP
+		auto len = (cmd == 1) ? readAndAdvance() : regRead<Geometry>(readAndAdvance(), pos);
+		advancePtr(len);
+		return;
+	}
+	case 9: { // SET
+		auto val = readAndAdvance();
+		regWrite(readAndAdvance(), val);
+		return;
+	}
+	case 10: { // COPY
+		auto val = regRead<Geometry>(readAndAdvance(), pos);
+		regWrite(readAndAdvance(), val);
+		return;
+	}
+	case 11: { // RSET
+		auto val = readAndAdvance();
+		regWrite(getIR0(), val);
+		return;
+	}
+	case 12: { // ADD
+		setoreg(getIR0() + getIR1());
+		return;
+	}
+	case 13: { // SUB
+		setoreg(getIR0() - getIR1());
+		return;
+	}
+	case 14: { // MUL
+		setoreg(getIR0() * getIR1());
+		return;
+	}
+	case 15: { // INC
+		auto reg = readAndAdvance();
+		regWrite(reg, regRead<Geometry>(reg, pos) + 1);
+		return;
+	}
+	case 16: { // DEC
+		auto reg = readAndAdvance();
+		regWrite(reg, regRead<Geometry>(reg, pos) - 1);
+		return;
+	}
+	case 17: { // IFZ
+		if (regRead<Geometry>(readAndAdvance(), pos) == 0) {
+			advancePtr(readAndAdvance());
+		} else {
+			advancePtr(1);
+		}
+		return;
+	}
+	case 18: { // IFL
+		auto regVal = regRead<Geometry>(readAndAdvance(), pos);
+		if (regVal < readAndAdvance()) {
+			advancePtr(readAndAdvance());
+		} else {
+			advancePtr(1);
+		}
+		return;
+	}
+	default:
+		advancePtr(cmd);
+		return;
+	}
+}
+
+template<typename Geometry>
 CellActionRequest* Cell::advanceBegin(Point pos) {
+#ifdef WITH_PROFILER
+	Profiler::Scope profile(profileClass(), genomeHash, opline);
+#endif
 	energy_income = 0;
 	if (heavyWait) {
 		--heavyWait;
@@ -38,28 +169,23 @@ CellActionRequest* Cell::advanceBegin(Point pos) {
 	action_request.type = CellActionRequestType::NONE;
 
 	// Used a lot, so turned into function
-	auto regreadline = [this, &pos]() { return regRead(readAndAdvance(), pos); };
+	auto regreadline = [this, &pos]() { return regRead<Geometry>(readAndAdvance(), pos); };
 	auto setoreg = [this](uint8_t val) { gRegs[1] = val; };
-	auto getIR0 = [this]() { return gRegs[2]; };
-	auto getIR1 = [this]() { return gRegs[3]; };
 
 	auto cmd = readAndAdvance();
-	switch (cmd) {
-	case 0: // HIB
-		energy_usage = 1;
-		return nullptr;
-	case 1:   // JMP
-	case 2: { // RJMP
-		auto len = (cmd == 1) ? readAndAdvance() : regreadline();
-		advancePtr(len);
+	if (isLocalOp(cmd)) {
+		stepLocal<Geometry>(cmd, pos);
 		return nullptr;
 	}
+
+	localStreak = 0;
+	switch (cmd) {
 	case 3:   // MOVE
 	case 4: { // RMOVE
 		energy_usage += 5 - std::min(power / 7, 5);
 		auto dir = DirectionHelper::create((cmd == 3) ? readAndAdvance() : regreadline());
-		if (pos.canApply(dir)) {
-			auto posRes = pos.apply(dir);
+		if (pos.canApply<Geometry>(dir)) {
+			auto posRes = pos.apply<Geometry>(dir);
 			SDL_assert_paranoid(posRes);
 			action_request.type = CellActionRequestType::MOVE;
 			action_request.dir = dir;
@@ -71,8 +197,8 @@ CellActionRequest* Cell::advanceBegin(Point pos) {
 	}
 	case 5:   // PROBE
 	case 6: { // RPROBE
-		if (pos.apply(DirectionHelper::create((cmd == 5) ? readAndAdvance() : regreadline()))) {
-			auto other = field.cellsField[pos.toArrayIdx()];
+		if (pos.apply<Geometry>(DirectionHelper::create((cmd == 5) ? readAndAdvance() : regreadline()))) {
+			auto other = field.cellsField[pos.toArrayIdx<Geometry>()];
 			if (other) {
 				setoreg(other->getEnergy());
 				return nullptr;
@@ -83,8 +209,8 @@ CellActionRequest* Cell::advanceBegin(Point pos) {
 	}
 	case 7:   // ANALYZE
 	case 8: { // RANALYZE
-		if (pos.apply(DirectionHelper::create((cmd == 7) ? readAndAdvance() : regreadline()))) {
-			auto other = field.cellsField[pos.toArrayIdx()];
+		if (pos.apply<Geometry>(DirectionHelper::create((cmd == 7) ? readAndAdvance() : regreadline()))) {
+			auto other = field.cellsField[pos.toArrayIdx<Geometry>()];
 			if (other) {
 				heavyWait = 1;
 				const auto& otherProg = other->getProgram();
@@ -99,64 +225,10 @@ CellActionRequest* Cell::advanceBegin(Point pos) {
 		setoreg(0);
 		return nullptr;
 	}
-	case 9: { // SET
-		auto val = readAndAdvance();
-		regWrite(readAndAdvance(), val);
-		return nullptr;
-	}
-	case 10: { // COPY
-		auto val = regRead(readAndAdvance(), pos);
-		regWrite(readAndAdvance(), val);
-		return nullptr;
-	}
-	case 11: { // RSET
-		auto val = readAndAdvance();
-		regWrite(getIR0(), val);
-		return nullptr;
-	}
-	case 12: { // ADD
-		setoreg(getIR0() + getIR1());
-		return nullptr;
-	}
-	case 13: { // SUB
-		setoreg(getIR0() - getIR1());
-		return nullptr;
-	}
-	case 14: { // MUL
-		setoreg(getIR0() * getIR1());
-		return nullptr;
-	}
-	case 15: { // INC
-		auto reg = readAndAdvance();
-		regWrite(reg, regRead(reg, pos) + 1);
-		return nullptr;
-	}
-	case 16: { // DEC
-		auto reg = readAndAdvance();
-		regWrite(reg, regRead(reg, pos) - 1);
-		return nullptr;
-	}
-	case 17: { // IFZ
-		if (regRead(readAndAdvance(), pos) == 0) {
-			advancePtr(readAndAdvance());
-		} else {
-			advancePtr(1);
-		}
-		return nullptr;
-	}
-	case 18: { // IFL
-		auto regVal = regRead(readAndAdvance(), pos);
-		if (regVal < readAndAdvance()) {
-			advancePtr(readAndAdvance());
-		} else {
-			advancePtr(1);
-		}
-		return nullptr;
-	}
 	case 19:   // EAT
 	case 20: { // REAT
 		auto dir = DirectionHelper::create((cmd == 19) ? readAndAdvance() : regreadline());
-		if (pos.apply(dir) and field.cellsField[pos.toArrayIdx()]) {
+		if (pos.apply<Geometry>(dir) and field.cellsField[pos.toArrayIdx<Geometry>()]) {
 			// Don't try to eat stuff if you can't do it
 			energy_usage += 6;
 			action_request.type = CellActionRequestType::EAT;
@@ -170,7 +242,7 @@ CellActionRequest* Cell::advanceBegin(Point pos) {
 	case 22: { // RENG
 		auto enAmount = (cmd == 21) ? readAndAdvance() : regreadline();
 		auto dir = DirectionHelper::create((cmd == 21) ? readAndAdvance() : regreadline());
-		if (enAmount < energy and pos.apply(dir) and field.cellsField[pos.toArrayIdx()]) {
+		if (enAmount < energy and pos.apply<Geometry>(dir) and field.cellsField[pos.toArrayIdx<Geometry>()]) {
 			energy_usage += enAmount;
 			action_request.type = CellActionRequestType::ENERGY;
 			action_request.dir = dir;
@@ -181,7 +253,21 @@ CellActionRequest* Cell::advanceBegin(Point pos) {
 		setoreg(0);
 		return nullptr;
 	}
-	// TODO: add FIND and FINDE opcodes
+	case 23:   // FIND
+	case 24: { // FINDE
+		// Nearest cell within given distance (FINDE: also with at least given energy)
+		// Result is 8 + direction towards it or 0 if there's none. RMOVE, REAT and others only look at
+		// lower 3 bits, so it can be passed to them as is.
+		uint8_t minEnergy = (cmd == 24) ? readAndAdvance() : 0;
+		auto radius = readAndAdvance();
+		heavyWait = 1;
+		if (auto other = field.index->findNearest<Geometry>(pos, radius, minEnergy)) {
+			setoreg(8 + uint8_t(directionTowards(pos, *other)));
+		} else {
+			setoreg(0);
+		}
+		return nullptr;
+	}
 	case 25:   // POW
 	case 26: { // RPOW
 		auto powAmount = (cmd == 25) ? readAndAdvance() : regreadline();
@@ -210,20 +296,103 @@ CellActionRequest* Cell::advanceBegin(Point pos) {
 		return nullptr;
 	}
 	default:
-		advancePtr(cmd);
-		return nullptr;
+		abort(); // Local opcodes are handled above
+	}
+}
+
+#ifdef WITH_PROFILER
+Profiler::OpClass Cell::profileClass() const {
+	if (heavyWait) return Profiler::OpClass::WAIT;
+	if (hibernate) return Profiler::OpClass::HIBERNATE;
+	return Profiler::classify(opline[execPtr]);
+}
+#endif
+
+bool Cell::stepIsolated() {
+	auto cmd = opline[execPtr];
+	if (!isLocalOp(cmd)) return false;
+	if ((read(execPtr + 1) & 0xF) < 3) {
+		// Reading energy, light or age would make loop depend on outside world
+		if (cmd == 2 or cmd == 10 or cmd == 17 or cmd == 18) return false;
+		// INC and DEC read their register too, but writes to these are ignored anyway
+		if (cmd == 15 or cmd == 16) {
+			advancePtr(2);
+			return true;
+		}
+	}
+	advancePtr(1);
+	// Position is only used to read light, which never happens here
+	stepLocal<DynamicGeometry>(cmd, Point(0, 0));
+	return true;
+}
+
+Cell::ExecState Cell::execState() const {
+	if (!loopLen) return {execPtr, gRegs};
+	// Replay loop up to current instruction
+	thread_local Cell scratch {0};
+	scratch.opline = opline;
+	scratch.execPtr = execPtr;
+	scratch.gRegs = gRegs;
+	for (size_t i = 0; i < (loopInstr + 1u) % loopLen; ++i) {
+		scratch.stepIsolated();
 	}
+	return {scratch.execPtr, scratch.gRegs};
 }
 
-EndMoveAction Cell::advanceEnd(Point pos, randomGenerator& rng) {
-	auto lightEng = field.lightMap[pos.toArrayIdx()] / 32;
+void Cell::unpark() {
+	if (!loopLen) return;
+	auto state = execState();
+	execPtr = state.execPtr;
+	gRegs = state.gRegs;
+	loopLen = 0;
+	localStreak = 0;
+}
+
+bool Cell::tryPark() {
+	thread_local Cell scratch {0};
+	scratch.opline = opline;
+	scratch.execPtr = execPtr;
+	scratch.gRegs = gRegs;
+
+	uint8_t len = 0;
+	loopHibOps = 0;
+	do {
+		// Longer loops are left to interpreter, schedule is kept in cell itself
+		if (len == maxLoop) return false;
+		loopHib[len] = scratch.gRegs[0];
+		if (scratch.opline[scratch.execPtr] == 0) loopHibOps |= 1 << len;
+		if (!scratch.stepIsolated()) return false;
+		++len;
+	} while (scratch.execPtr != execPtr or scratch.gRegs != gRegs);
+
+	// Last instruction is done hibernating, so first one is executed next
+	loopLen = len;
+	loopInstr = len - 1;
+	return true;
+}
+
+template<typename Geometry>
+EndMoveAction Cell::advanceEnd(Point pos, randomGenerator& rng, bool fastForward) {
+	if (loopLen) {
+		// Does what advanceBegin() would have done
+		if (hibernate) {
+			--hibernate;
+			energy_usage = 1;
+		} else {
+			loopInstr = (loopInstr + 1 == loopLen) ? 0 : loopInstr + 1;
+			hibernate = loopHib[loopInstr];
+			energy_usage = ((loopHibOps >> loopInstr) & 1) ? 1 : 2;
+		}
+	}
+
+	auto lightEng = field.light(pos.toArrayIdx<Geometry>()) / 32;
 	auto powerMod = power / 10;
 	if (lightEng > powerMod) addEnergy(lightEng - powerMod);
 
 	if (energy_income < energy_usage) {
 		energy_usage -= energy_income;
 		// Dead from energy underflow
-		if (energy_usage > energy) return EndMoveAction::DIE;
+		if (energy_usage > energy) return EndMoveAction::DIE_STARVED;
 		energy -= energy_usage;
 	} else {
 		energy_income -= energy_usage;
@@ -234,7 +403,7 @@ EndMoveAction Cell::advanceEnd(Point pos, randomGenerator& rng) {
 	++age;
 	std::uniform_int_distribution<size_t> dist(age, 1024);
 	// Dead from old age
-	if (dist(rng) == 1024) return EndMoveAction::DIE;
+	if (dist(rng) == 1024) return EndMoveAction::DIE_OLD;
 
 	switch (action_request.type) {
 	case CellActionRequestType::MOVE:
@@ -246,6 +415,15 @@ EndMoveAction Cell::advanceEnd(Point pos, randomGenerator& rng) {
 		break;
 	}
 
+	if (fastForward and !loopLen and !heavyWait and !hibernate and action_request.type == CellActionRequestType::NONE
+		and localStreak >= (16u << parkBackoff)) {
+		if (tryPark()) parkBackoff = 0;
+		else parkBackoff = std::min(parkBackoff + 1, 5);
+		localStreak = 0;
+	}
+	// advanceBegin() is skipped for parked cells, so reset it for next tick here
+	if (loopLen) energy_income = 0;
+
 	if (energy >= 200) { // Division time!
 		energy /= 2;
 		return EndMoveAction::DIVIDE;
@@ -254,20 +432,132 @@ EndMoveAction Cell::advanceEnd(Point pos, randomGenerator& rng) {
 	return EndMoveAction::NONE;
 }
 
-std::unique_ptr<Cell> Cell::fork() const {
-	auto n = std::make_unique<Cell>();
+Cell::Cell(uint64_t id_, const Program& program, std::optional<uint8_t> energy_, const std::optional<Registers>& regs):
+	id(id_),
+	genomeHash(hashGenome(program)),
+	opline(program)
+{
+	if (energy_) energy = *energy_;
+	if (regs) gRegs = *regs;
+}
+
+std::unique_ptr<Cell> Cell::fork(uint64_t childId) const {
+	auto n = std::make_unique<Cell>(childId);
 
 	n->energy = energy;
 	n->power = power / 10;
 	n->opline = opline;
+	n->genomeHash = genomeHash;
 
 	return n;
 }
 
-void Cell::mutate(size_t cnt, randomGenerator& rng) {
-	std::uniform_int_distribution<size_t> posDist(0, opline.size());
+uint64_t Cell::hashGenome(const Program& program) {
+	uint64_t hash = 0;
+	for (size_t i = 0; i < program.size(); ++i) {
+		hash += genomeHashTerm(i, program[i]);
+	}
+	return hash;
+}
+
+// Computed at compile time, so cells made during static initialization get it right too
+const uint64_t Cell::emptyGenomeHash = [] {
+	uint64_t hash = 0;
+	for (size_t i = 0; i < std::tuple_size_v<Program>; ++i) {
+		hash += genomeHashTerm(i, 0);
+	}
+	return hash;
+}();
+
+size_t Cell::mutate(size_t cnt, randomGenerator& rng) {
+	if (cnt == 0) return 0;
+	// Draws may hit the same byte twice or write the value it already has, so compare afterwards
+	auto original = opline;
+	std::uniform_int_distribution<size_t> posDist(0, opline.size() - 1);
 	std::uniform_int_distribution<size_t> cmdDist(0, 0xFF);
 	for (size_t i = 0; i < cnt; ++i) {
-		opline[posDist(rng)] = cmdDist(rng);
+		auto pos = posDist(rng);
+		uint8_t cmd = cmdDist(rng);
+		genomeHash += genomeHashTerm(pos, cmd) - genomeHashTerm(pos, opline[pos]);
+		opline[pos] = cmd;
+	}
+	size_t changed = 0;
+	for (size_t i = 0; i < opline.size(); ++i) {
+		changed += opline[i] != original[i];
+	}
+	return changed;
+}
+
+void Cell::save(std::ostream& out) const {
+	auto state = execState();
+	writeLE(out, id);
+	writeLE<uint8_t>(out, state.execPtr);
+	writeLE<uint64_t>(out, age);
+	writeLE(out, energy);
+	writeLE(out, power);
+	out.write(reinterpret_cast<const char*>(opline.data()), opline.size());
+	out.write(reinterpret_cast<const char*>(state.gRegs.data()), state.gRegs.size());
+	writeLE<uint64_t>(out, heavyWait);
+	writeLE<uint64_t>(out, hibernate);
+	// Result of last request is delivered again while cell is waiting
+	writeLE<uint8_t>(out, uint8_t(action_request.type));
+	writeLE(out, action_request.dir);
+	writeLE(out, action_request.num);
+	writeLE(out, action_request.res);
+}
+
+std::unique_ptr<Cell> Cell::load(std::istream& in) {
+	auto cell = std::make_unique<Cell>(readLE<uint64_t>(in));
+	cell->execPtr = readLE<uint8_t>(in);
+	cell->age = readLE<uint64_t>(in);
+	cell->energy = readLE<uint8_t>(in);
+	cell->power = readLE<uint8_t>(in);
+	in.read(reinterpret_cast<char*>(cell->opline.data()), cell->opline.size());
+	in.read(reinterpret_cast<char*>(cell->gRegs.data()), cell->gRegs.size());
+	cell->heavyWait = readLE<uint64_t>(in);
+	cell->hibernate = readLE<uint64_t>(in);
+	cell->action_request.type = CellActionRequestType(readLE<uint8_t>(in));
+	cell->action_request.dir = readLE<Direction>(in);
+	cell->action_request.num = readLE<uint8_t>(in);
+	cell->action_request.res = readLE<uint8_t>(in);
+
+	if (cell->id == 0 or cell->execPtr >= cell->opline.size() or cell->action_request.type > CellActionRequestType::EAT) {
+		throw std::runtime_error("Malformed cell state");
 	}
+	cell->genomeHash = hashGenome(cell->opline);
+	return cell;
 }
+
+std::optional<std::string> Cell::compareState(const Cell& other) const {
+	// Parked cells keep their state elsewhere
+	auto state = execState(), otherState = other.execState();
+	std::optional<std::string> diff;
+	auto check = [&diff](const std::string& name, size_t a, size_t b) {
+		if (a != b) diff = name + " " + std::to_string(a) + " vs " + std::to_string(b);
+		return a != b;
+	};
+	// Energy income and usage are scratch values of a single tick, so they aren't compared
+	if (check("id", id, other.id) or check("execPtr", state.execPtr, otherState.execPtr) or check("age", age, other.age)
+		or check("energy", energy, other.energy) or check("power", power, other.power)
+		or check("heavyWait", heavyWait, other.heavyWait) or check("hibernate", hibernate, other.hibernate)
+		or check("request.type", size_t(action_request.type), size_t(other.action_request.type))
+		or check("request.dir", size_t(action_request.dir), size_t(other.action_request.dir))
+		or check("request.num", action_request.num, other.action_request.num)
+		or check("request.res", action_request.res, other.action_request.res)
+		or check("genomeHash", genomeHash, other.genomeHash)) {
+		return diff;
+	}
+	for (size_t i = 0; i < opline.size(); ++i) {
+		if (check("program[" + std::to_string(i) + "]", opline[i], other.opline[i])) return diff;
+	}
+	for (size_t i = 0; i < gRegs.size(); ++i) {
+		if (check("register " + std::to_string(i + 3), state.gRegs[i], otherState.gRegs[i])) return diff;
+	}
+	return std::nullopt;
+}
+
+#define INSTANTIATE_FOR_GEOMETRY(...) \
+	template CellActionRequest* Cell::advanceBegin<__VA_ARGS__>(Point pos); \
+	template EndMoveAction Cell::advanceEnd<__VA_ARGS__>(Point pos, randomGenerator& rng, bool fastForward);
+INSTANTIATE_FOR_EACH_GEOMETRY
+#undef INSTANTIATE_FOR_GEOMETRY
@@ -2,8 +2,14 @@
 
 #include <vector>
 #include <array>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
 
 #include "Global.hpp"
+#include "Profiler.hpp"
 
 enum class CellActionRequestType {
 	NONE,
@@ -15,7 +21,8 @@ enum class CellActionRequestType {
 enum class EndMoveAction {
 	NONE,
 	DIVIDE,
-	DIE
+	DIE_STARVED,
+	DIE_OLD
 };
 
 struct CellActionRequest {
@@ -27,10 +34,18 @@ struct CellActionRequest {
 
 class Cell {
 	public:
+		using Program = std::array<uint8_t, 127>;
+		using Registers = std::array<uint8_t, 13>;
+
 		// Object's lifecycle
-		Cell() = default;
+		// Cells are identified by IDs unique within their world, 0 is never used
+		explicit Cell(uint64_t id_): id(id_) {};
+		// Cell starting with given program and, if set, energy and registers
+		Cell(uint64_t id_, const Program& program, std::optional<uint8_t> energy_, const std::optional<Registers>& regs);
 		explicit Cell(const Cell&) = delete;
 		Cell(Cell&& o):
+			id(std::move(o.id)),
+			genomeHash(std::move(o.genomeHash)),
 			execPtr(std::move(o.execPtr)),
 			age(std::move(o.age)),
 			energy(std::move(o.energy)),
@@ -45,43 +60,79 @@ class Cell {
 			energy_income(std::move(o.energy_income)),
 			energy_usage(std::move(o.energy_usage)),
 
-			action_request(std::move(o.action_request))
+			action_request(std::move(o.action_request)),
+
+			loopHib(std::move(o.loopHib)),
+			loopHibOps(std::move(o.loopHibOps)),
+			loopLen(std::move(o.loopLen)),
+			loopInstr(std::move(o.loopInstr)),
+			localStreak(std::move(o.localStreak)),
+			parkBackoff(std::move(o.parkBackoff))
 		{};
 
 		// Main functions, they can be called in threaded context
 		// Called at the beginning of handling cycle
+		template<typename Geometry = DynamicGeometry>
 		CellActionRequest* advanceBegin(Point pos);
 // 		// Called at the end of it
-		EndMoveAction advanceEnd(Point pos, randomGenerator& rng);
+		// With `fastForward` cell might get parked (see isParked()) if it's stuck in a suitable loop
+		template<typename Geometry = DynamicGeometry>
+		EndMoveAction advanceEnd(Point pos, randomGenerator& rng, bool fastForward);
+
+		// Fast-forward: cell that loops through local instructions without reading energy, light or age can't be
+		// affected by anything around it, so its instructions repeat forever with period known in advance.
+		// Such cells are parked: advanceBegin() must not be called for them, advanceEnd() charges energy
+		// according to precomputed schedule instead. State is the same as if it was executed normally.
+		bool isParked() const { return loopLen; };
+		// Go back to normal execution
+		void unpark();
 
 		// Useful for creating new cells
 		// Doesn't trigger mutation by itself!
-		std::unique_ptr<Cell> fork() const;
+		std::unique_ptr<Cell> fork(uint64_t childId) const;
 
 		// Used to access cell's internals
 		void addEnergy(uint8_t eeng) {
 			if ((uint8_t)(eeng + energy_income) < energy_income) energy_income = 255;
 			else energy_income += eeng;
 		};
+		uint64_t getId() const { return id; };
+		size_t getAge() const { return age; };
 		uint8_t getEnergy() const { return energy; };
 		uint8_t getPower() const { return power; };
 		auto const& getProgram() const {
 			return opline;
 		};
+		// Kept up to date by mutate(), equal to hashGenome(getProgram())
+		uint64_t getGenomeHash() const { return genomeHash; };
+		static uint64_t hashGenome(const Program& program);
+		// hashGenome() of all-zero program that cells start with
+		static const uint64_t emptyGenomeHash;
+		// General purpose registers as seen by program (register 3 onwards)
+		Registers getRegisters() const { return execState().gRegs; };
 		// Needed if map was touched
 		CellActionRequest* getActionPtr() {return &action_request;};
 
 		// Rarely called but VERY important function
-		// Change up to cnt bytes in cell's program
-		void mutate(size_t cnt, randomGenerator& rng);
+		// Change up to cnt bytes in cell's program, returns how many bytes actually differ afterwards
+		size_t mutate(size_t cnt, randomGenerator& rng);
+
+		// Full state as of between ticks, for checkpoints
+		void save(std::ostream& out) const;
+		// Throws on malformed input
+		static std::unique_ptr<Cell> load(std::istream& in);
+		// First field that differs from `other` with both values, nothing if states are identical
+		std::optional<std::string> compareState(const Cell& other) const;
 	private:
+		uint64_t id;
+		uint64_t genomeHash = emptyGenomeHash;
 		size_t execPtr = 0;
 		size_t age = 0;
 		uint8_t energy = 100;
 		uint8_t power = 0;
 
-		std::array<uint8_t, 127> opline = {0};
-		std::array<uint8_t, 13> gRegs = {0}; // Registers that don't require special reads.
+		Program opline = {0};
+		Registers gRegs = {0}; // Registers that don't require special reads.
 
 		size_t heavyWait = 0;
 		size_t hibernate = 0;
@@ -89,11 +140,45 @@ class Cell {
 		// Reset every tick
 		uint8_t energy_income = 0;
 		uint8_t energy_usage = 0;
-		CellActionRequest action_request;
+		CellActionRequest action_request {};
+
+		// Loop of parked cell: hibernation after each instruction, which ones are HIB, length (0 if not parked)
+		// and the last one executed. execPtr and gRegs stay at start of the loop, hibernate keeps counting down as usual.
+		static constexpr size_t maxLoop = 16;
+		std::array<uint8_t, maxLoop> loopHib {};
+		uint16_t loopHibOps = 0;
+		uint8_t loopLen = 0;
+		uint8_t loopInstr = 0;
+		// Local instructions executed in a row, parking is attempted when it gets high enough
+		uint32_t localStreak = 0;
+		// Every failed attempt doubles the wait for next one
+		uint8_t parkBackoff = 0;
+
+		// Execution state as seen by program, parked or not
+		struct ExecState {
+			size_t execPtr;
+			Registers gRegs;
+		};
+		ExecState execState() const;
+		// Execute next instruction if it can be part of a loop, return false otherwise
+		bool stepIsolated();
+		bool tryPark();
 
+		template<typename Geometry>
 		uint8_t regRead(uint8_t reg, const Point& pos) const;
 		void regWrite(uint8_t reg, uint8_t val);
 
+		// Opcodes that don't look at anything but cell itself (other than light level)
+		static constexpr bool isLocalOp(uint8_t cmd) {
+			return !((cmd >= 3 and cmd <= 8) or (cmd >= 19 and cmd <= 28));
+		};
+		template<typename Geometry>
+		void stepLocal(uint8_t cmd, const Point& pos);
+
+#ifdef WITH_PROFILER
+		Profiler::OpClass profileClass() const;
+#endif
+
 		uint8_t read(size_t addr) const {
 			return opline[addr % opline.size()];
 		};
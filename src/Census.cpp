@@ -0,0 +1,55 @@
+#include "Census.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <SDL_assert.h>
+
+#include "Memory.hpp"
+
+static double countLog(size_t count) {
+	return (count > 1) ? double(count) * std::log(double(count)) : 0.0;
+}
+
+void Census::add(uint64_t genome, size_t tick) {
+	auto it = strains.try_emplace(genome, StrainInfo {0, tick}).first;
+	auto& info = it->second;
+	countLogSum += countLog(info.count + 1) - countLog(info.count);
+	++info.count;
+	++total;
+}
+
+void Census::remove(uint64_t genome) {
+	auto it = strains.find(genome);
+	SDL_assert(it != strains.end());
+	auto& info = it->second;
+	countLogSum += countLog(info.count - 1) - countLog(info.count);
+	--total;
+	if (--info.count == 0) strains.erase(it);
+	// Don't let rounding errors pile up forever
+	if (total == 0) countLogSum = 0;
+}
+
+double Census::shannon() const {
+	if (total == 0) return 0;
+	// H = -sum(p * ln(p)) = ln(N) - sum(c * ln(c)) / N
+	return std::max(0.0, std::log(double(total)) - countLogSum / double(total));
+}
+
+std::vector<Census::Strain> Census::top(size_t n) const {
+	std::vector<Strain> result;
+	result.reserve(strains.size());
+	for (const auto& pair : strains) {
+		result.push_back({pair.first, pair.second.count, pair.second.firstSeen});
+	}
+	auto topEnd = result.begin() + std::min(n, result.size());
+	std::partial_sort(result.begin(), topEnd, result.end(), [](const Strain& a, const Strain& b) {
+		return a.count > b.count;
+	});
+	result.erase(topEnd, result.end());
+	return result;
+}
+
+size_t Census::memoryUsage() const {
+	return containerBytes(strains);
+}
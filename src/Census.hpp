@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Live table of strains (cells with identical genomes, keyed by Cell::getGenomeHash())
+// Updated on every birth and death, so diversity can be queried each tick without scanning population
+class Census {
+	public:
+		struct Strain {
+			uint64_t genome;
+			size_t count;
+			// Tick on which first cell of this strain appeared since it was last extinct
+			size_t firstSeen;
+		};
+
+		void add(uint64_t genome, size_t tick);
+		void remove(uint64_t genome);
+
+		size_t population() const { return total; };
+		// Amount of distinct strains alive
+		size_t richness() const { return strains.size(); };
+		// Shannon index, in nats
+		double shannon() const;
+		// Most numerous strains, largest first. Cost depends on amount of strains, not cells.
+		std::vector<Strain> top(size_t n) const;
+		// Estimated heap usage of the table, in bytes
+		size_t memoryUsage() const;
+
+	private:
+		struct StrainInfo {
+			size_t count;
+			size_t firstSeen;
+		};
+
+		std::unordered_map<uint64_t, StrainInfo> strains;
+		size_t total = 0;
+		// Sum of count * ln(count) over all strains, enough to get Shannon index in O(1)
+		double countLogSum = 0;
+};
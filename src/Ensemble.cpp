@@ -0,0 +1,88 @@
+#include "Ensemble.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <SDL_log.h>
+
+#include "World.hpp"
+
+std::vector<EnsembleMember> parseEnsembleSpec(std::istream& in) {
+	std::vector<EnsembleMember> members;
+	std::string line;
+	size_t lineNum = 0;
+	while (std::getline(in, line)) {
+		++lineNum;
+		if (line.empty() or line[0] == '#') continue;
+
+		std::istringstream stream {line};
+		EnsembleMember m;
+		stream >> m.fieldW >> m.fieldH >> m.mutationRate >> m.seed >> m.ticks;
+		if (!stream or m.fieldW == 0 or m.fieldH == 0) {
+			throw std::runtime_error("Invalid ensemble spec on line " + std::to_string(lineNum) + ": " + line);
+		}
+		members.push_back(m);
+	}
+	return members;
+}
+
+static void runMember(const EnsembleMember& m, const std::string& path) {
+	std::ofstream out(path);
+	if (!out) throw std::runtime_error("Can't open " + path + " for writing");
+
+	World world(m.fieldW, m.fieldH, m.seed);
+	world.bind();
+	world.mutationRate = m.mutationRate;
+	world.spawnRandomCells(10);
+
+	out << "tick,population,energy,power,strains,shannon\n";
+	for (size_t i = 0; i < m.ticks; ++i) {
+		world.tick();
+		auto stats = world.collectStats();
+		const auto& census = world.getCensus();
+		out << world.getTickCount() << ',' << stats.population << ',' << stats.totalEnergy << ',' << stats.totalPower
+			<< ',' << census.richness() << ',' << census.shannon() << '\n';
+	}
+
+	if (!out) throw std::runtime_error("Failed writing " + path);
+}
+
+void runEnsemble(const std::vector<EnsembleMember>& members, const std::string& outDir, size_t threads) {
+	if (threads == 0) threads = 1;
+	threads = std::min(threads, members.size());
+
+	std::atomic<size_t> next {0};
+	std::exception_ptr error;
+	std::mutex errorLock;
+
+	auto worker = [&]() {
+		size_t i;
+		while ((i = next++) < members.size()) {
+			try {
+				runMember(members[i], outDir + "/world-" + std::to_string(i) + ".csv");
+				SDL_Log("World %zu finished", i);
+			} catch (...) {
+				std::lock_guard lock(errorLock);
+				if (!error) error = std::current_exception();
+				// Don't start anything new, we're failing anyway
+				next = members.size();
+			}
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i < threads; ++i) {
+		workers.emplace_back(worker);
+	}
+	for (auto& thread : workers) {
+		thread.join();
+	}
+
+	if (error) std::rethrow_exception(error);
+}
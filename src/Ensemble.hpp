@@ -0,0 +1,24 @@
+#pragma once
+
+#include <istream>
+#include <string>
+#include <vector>
+
+// One independent world of an ensemble run
+struct EnsembleMember {
+	size_t fieldW;
+	size_t fieldH;
+	size_t mutationRate;
+	uint_fast32_t seed;
+	size_t ticks;
+};
+
+// Sweep spec is a text file with one world per line:
+//   WIDTH HEIGHT MUTATION_RATE SEED TICKS
+// Empty lines and lines starting with '#' are ignored.
+std::vector<EnsembleMember> parseEnsembleSpec(std::istream& in);
+
+// Run every member to completion using up to `threads` workers, one world per worker at a time
+// Statistics of world number N are written to `outDir`/world-N.csv, one line per tick:
+//   tick,population,energy,power,strains,shannon
+void runEnsemble(const std::vector<EnsembleMember>& members, const std::string& outDir, size_t threads);
@@ -1,10 +1,9 @@
 #pragma once
 
 #include <cstddef>
+#include <functional>
 #include <optional>
-#include <memory>
 #include <random>
-#include <unordered_map>
 #include <SDL_assert.h>
 
 // We don't really need good RNG, speed is much more important
@@ -15,7 +14,46 @@ struct GlobalSettingsType {
 	size_t fieldW;
 };
 
-extern GlobalSettingsType global;
+// Settings of the world current thread is working on, set by World::bind()
+extern thread_local GlobalSettingsType global;
+
+// World geometry policies. Hot code is templated on them so that for common field sizes
+// dimensions are compile-time constants: index math turns into shifts and loops get fixed trip counts.
+// Anything not listed in FOR_EACH_FIXED_GEOMETRY falls back to DynamicGeometry.
+struct DynamicGeometry {
+	static size_t width() { return global.fieldW; };
+	static size_t height() { return global.fieldH; };
+};
+
+template<size_t W, size_t H>
+struct FixedGeometry {
+	static constexpr size_t width() { return W; };
+	static constexpr size_t height() { return H; };
+};
+
+// X(WIDTH, HEIGHT) for every specialized size. Keep heights powers of two, they're the stride of all maps.
+#define FOR_EACH_FIXED_GEOMETRY(X) \
+	X(256, 256) \
+	X(512, 512) \
+	X(1024, 1024) \
+	X(2048, 2048)
+
+// Call `fn` with geometry matching given dimensions and return its result
+// Meant to be used once at startup to pick function pointers to specialized kernels
+template<typename Fn>
+auto dispatchGeometry(size_t w, size_t h, Fn&& fn) {
+#define DISPATCH_FIXED_GEOMETRY(W, H) if (w == W and h == H) return fn(FixedGeometry<W, H>());
+	FOR_EACH_FIXED_GEOMETRY(DISPATCH_FIXED_GEOMETRY)
+#undef DISPATCH_FIXED_GEOMETRY
+	return fn(DynamicGeometry());
+}
+
+// Expands to `INSTANTIATE_FOR_GEOMETRY(Geometry)` for every known geometry
+// Define INSTANTIATE_FOR_GEOMETRY(...) first, geometry is passed as variadic argument since it contains commas
+#define INSTANTIATE_FOR_FIXED_GEOMETRY(W, H) INSTANTIATE_FOR_GEOMETRY(FixedGeometry<W, H>)
+#define INSTANTIATE_FOR_EACH_GEOMETRY \
+	INSTANTIATE_FOR_GEOMETRY(DynamicGeometry) \
+	FOR_EACH_FIXED_GEOMETRY(INSTANTIATE_FOR_FIXED_GEOMETRY)
 
 enum class Direction : uint8_t {
 	UPLEFT		= 0,
@@ -46,12 +84,15 @@ struct Point {
 
 	Point(size_t y_, size_t x_): y(y_), x(x_) {};
 
-	[[nodiscard]] size_t toArrayIdx() const { return x * global.fieldH + y; };
+	template<typename Geometry = DynamicGeometry>
+	[[nodiscard]] size_t toArrayIdx() const { return x * Geometry::height() + y; };
 
 	bool operator==(const Point& other) const {return other.y == y and other.x == x; };
 
-	void checkBounds() const { SDL_assert_paranoid(y < global.fieldH and x < global.fieldW); };
+	template<typename Geometry = DynamicGeometry>
+	void checkBounds() const { SDL_assert_paranoid(y < Geometry::height() and x < Geometry::width()); };
 
+	template<typename Geometry = DynamicGeometry>
 	bool canApply(Direction dir) const {
 		switch (dir) {
 		case Direction::UPLEFT:
@@ -59,21 +100,22 @@ struct Point {
 		case Direction::UP:
 			return !(y == 0);
 		case Direction::UPRIGHT:
-			return !(y == 0 or x == global.fieldW - 1);
+			return !(y == 0 or x == Geometry::width() - 1);
 		case Direction::RIGHT:
-			return !(x == global.fieldW - 1);
+			return !(x == Geometry::width() - 1);
 		case Direction::DOWNRIGHT:
-			return !(y == global.fieldH - 1 or x == global.fieldW - 1);
+			return !(y == Geometry::height() - 1 or x == Geometry::width() - 1);
 		case Direction::DOWN:
-			return !(y == global.fieldH - 1);
+			return !(y == Geometry::height() - 1);
 		case Direction::DOWNLEFT:
-			return !(y == global.fieldH - 1 or x == 0);
+			return !(y == Geometry::height() - 1 or x == 0);
 		case Direction::LEFT:
 			return !(x == 0);
 		};
 		abort(); // Clearly something is terribly off
 	};
 
+	template<typename Geometry = DynamicGeometry>
 	bool apply(Direction dir) {
 		switch (dir) {
 		case Direction::UPLEFT:
@@ -86,25 +128,25 @@ struct Point {
 			--y;
 			break;
 		case Direction::UPRIGHT:
-			if (y == 0 or x == global.fieldW - 1) return false;
+			if (y == 0 or x == Geometry::width() - 1) return false;
 			--y;
 			++x;
 			break;
 		case Direction::RIGHT:
-			if (x == global.fieldW - 1) return false;
+			if (x == Geometry::width() - 1) return false;
 			++x;
 			break;
 		case Direction::DOWNRIGHT:
-			if (y == global.fieldH - 1 or x == global.fieldW - 1) return false;
+			if (y == Geometry::height() - 1 or x == Geometry::width() - 1) return false;
 			++y;
 			++x;
 			break;
 		case Direction::DOWN:
-			if (y == global.fieldH - 1) return false;
+			if (y == Geometry::height() - 1) return false;
 			++y;
 			break;
 		case Direction::DOWNLEFT:
-			if (y == global.fieldH - 1 or x == 0) return false;
+			if (y == Geometry::height() - 1 or x == 0) return false;
 			++y;
 			--x;
 			break;
@@ -149,9 +191,10 @@ struct Point {
 		};
 	};
 
+	template<typename Geometry = DynamicGeometry>
 	std::optional<Point> applyNew(Direction dir) const {
 		Point other = *this;
-		if (other.apply(dir))
+		if (other.apply<Geometry>(dir))
 			return other;
 		else
 			return std::nullopt;
@@ -161,17 +204,32 @@ struct Point {
 template<>
 struct std::hash<Point> {
 	std::size_t operator()(const Point &obj) const {
-		return static_cast<size_t>(obj.y ^ obj.x);
+		// Plain y ^ x maps a whole W x H field onto max(W, H) values, so buckets were getting huge
+		return static_cast<size_t>(((uint64_t(obj.x) << 32) | uint64_t(obj.y)) * 0x9E3779B97F4A7C15ull >> 16);
 	}
 };
 
 class Cell;
+class SpatialIndex;
 
+// Non-owning view of the parts of world cells are allowed to look at
+// Storage itself belongs to World
 struct GlobalFieldType {
-	std::unordered_map<Point, std::unique_ptr<Cell>> cellsMap;
-	std::unique_ptr<Cell*[]> cellsField;
-	// Note: light map is stored column-by-column to optimize memory access
-	std::unique_ptr<uint8_t[]> lightMap;
+	Cell** cellsField;
+	// Energy and power of cells as of the end of last tick, laid out like cellsField. Empty slots are 0.
+	const uint8_t* energyPlane;
+	const uint8_t* powerPlane;
+	// Note: shadow map is stored column-by-column to optimize memory access
+	uint8_t* shadowMap;
+	const uint8_t* maxLight;
+	// Up to date for the whole first round of tick, see World::tickImpl()
+	const SpatialIndex* index;
+
+	uint8_t light(size_t idx) const {
+		auto shadow = shadowMap[idx];
+		return (shadow < *maxLight) ? *maxLight - shadow : 0;
+	};
 };
 
-extern GlobalFieldType field;
+// Field of the world current thread is working on, set by World::bind()
+extern thread_local GlobalFieldType field;
@@ -0,0 +1,137 @@
+#include "Lineage.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <stdexcept>
+
+#include <SDL_log.h>
+
+static std::atomic<uint64_t> nextInstance {1};
+
+template<typename T>
+static void putLE(std::vector<char>& buffer, T val) {
+	for (size_t i = 0; i < sizeof(T); ++i) {
+		buffer.push_back(char((uint64_t(val) >> (i * 8)) & 0xFF));
+	}
+}
+
+LineageLog::LineageLog(const std::string& path, size_t fieldW, size_t fieldH):
+	instance(nextInstance++),
+	out(path, std::ios::binary)
+{
+	if (!out) throw std::runtime_error("Can't open " + path + " for writing");
+
+	std::vector<char> header {'C', 'S', 'L', 'I', 'N', 'E', 'A', 'G'};
+	putLE<uint32_t>(header, 1);
+	putLE<uint32_t>(header, fieldW);
+	putLE<uint32_t>(header, fieldH);
+	out.write(header.data(), header.size());
+
+	writer = std::thread(&LineageLog::writerLoop, this);
+}
+
+LineageLog::~LineageLog() {
+	stop.store(true, std::memory_order_release);
+	wake.notify_one();
+	writer.join();
+
+	out.flush();
+	if (!out) SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed writing lineage log, it is incomplete");
+}
+
+LineageLog::Ring& LineageLog::threadRing() {
+	// Rings are only ever added, so cached pointers stay valid for as long as their logs live
+	// Instances are never reused, so entries of destroyed logs just never match again.
+	struct CachedRing {
+		uint64_t instance;
+		Ring* ring;
+	};
+	thread_local std::array<CachedRing, 4> cache {};
+	thread_local size_t cacheNext = 0;
+	for (const auto& entry : cache) {
+		if (entry.instance == instance) return *entry.ring;
+	}
+
+	// Evicted from cache or never seen, so look for ring this thread already owns before making a new one
+	Ring* ring = nullptr;
+	{
+		auto self = std::this_thread::get_id();
+		std::lock_guard lock(ringsLock);
+		for (auto& candidate : rings) {
+			if (candidate->owner == self) {
+				ring = candidate.get();
+				break;
+			}
+		}
+		if (!ring) {
+			rings.push_back(std::make_unique<Ring>());
+			ring = rings.back().get();
+			ring->owner = self;
+		}
+	}
+	cache[cacheNext++ % cache.size()] = {instance, ring};
+	return *ring;
+}
+
+void LineageLog::push(const Event& ev) {
+	auto& ring = threadRing();
+	auto head = ring.head.load(std::memory_order_relaxed);
+	// Writer fell behind, wait for it rather than lose events
+	while (head - ring.tail.load(std::memory_order_acquire) == Ring::capacity) {
+		wake.notify_one();
+		std::this_thread::yield();
+	}
+	ring.events[head % Ring::capacity] = ev;
+	ring.head.store(head + 1, std::memory_order_release);
+}
+
+void LineageLog::birth(uint64_t tick, uint64_t id, uint64_t parent, const Point& pos, size_t mutations) {
+	push(Event {tick, id, parent, uint32_t(pos.x), uint32_t(pos.y), 0, uint8_t(std::min<size_t>(mutations, 255))});
+}
+
+void LineageLog::death(uint64_t tick, uint64_t id, DeathCause cause, uint64_t age, const Point& pos) {
+	push(Event {tick, id, age, uint32_t(pos.x), uint32_t(pos.y), 1, uint8_t(cause)});
+}
+
+size_t LineageLog::drain(std::vector<char>& buffer) {
+	size_t written = 0;
+	std::lock_guard lock(ringsLock);
+	for (auto& ring : rings) {
+		auto tail = ring->tail.load(std::memory_order_relaxed);
+		auto head = ring->head.load(std::memory_order_acquire);
+		if (tail == head) continue;
+
+		buffer.clear();
+		for (auto i = tail; i != head; ++i) {
+			const auto& ev = ring->events[i % Ring::capacity];
+			putLE(buffer, ev.type);
+			putLE(buffer, ev.detail);
+			putLE(buffer, ev.x);
+			putLE(buffer, ev.y);
+			putLE(buffer, ev.tick);
+			putLE(buffer, ev.id);
+			putLE(buffer, ev.ref);
+		}
+		// Slots are free as soon as they're serialized
+		ring->tail.store(head, std::memory_order_release);
+		out.write(buffer.data(), buffer.size());
+		written += head - tail;
+	}
+	return written;
+}
+
+void LineageLog::writerLoop() {
+	std::vector<char> buffer;
+	buffer.reserve(Ring::capacity * 34);
+	while (true) {
+		// Check before draining, so nothing pushed before destruction is missed
+		bool stopping = stop.load(std::memory_order_acquire);
+		auto written = drain(buffer);
+		if (stopping) break;
+		if (written == 0) {
+			std::unique_lock lock(wakeLock);
+			wake.wait_for(lock, std::chrono::milliseconds(10));
+		}
+	}
+}
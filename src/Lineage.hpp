@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Global.hpp"
+
+enum class DeathCause : uint8_t {
+	STARVED, // Energy underflow
+	OLD_AGE,
+	EATEN
+};
+
+// Binary stream of births and deaths, enough to rebuild phylogeny offline
+// Events are queued into per-thread lock-free rings and written to file by a background thread,
+// so simulation threads never touch the file.
+//
+// File format, all integers are little-endian:
+//   Header, 20 bytes: "CSLINEAG", u32 version (1), u32 field width, u32 field height
+//   Records, 34 bytes each:
+//     u8 type (0 - birth, 1 - death)
+//     u8 detail (birth: bytes of program that differ from parent's, saturated at 255; death: DeathCause)
+//     u32 x, u32 y
+//     u64 tick
+//     u64 cell ID (never 0)
+//     u64 reference (birth: parent ID or 0 for spawned cells; death: age in ticks)
+// Records from one thread are in order, but rings are drained independently, so file is only ordered per thread.
+// Cells spawned or seeded between ticks can divide or die on the tick they were born, and their birth may land
+// in another thread's ring than their death or their children's births. Sorting by tick, then births before deaths,
+// then cell ID restores causal order, since IDs are handed out in increasing order and parents always precede children.
+class LineageLog {
+	public:
+		// Throws if file can't be opened
+		LineageLog(const std::string& path, size_t fieldW, size_t fieldH);
+		LineageLog(const LineageLog&) = delete;
+		LineageLog& operator=(const LineageLog&) = delete;
+		// Writes out everything still queued
+		~LineageLog();
+
+		// Thread-safe
+		void birth(uint64_t tick, uint64_t id, uint64_t parent, const Point& pos, size_t mutations);
+		void death(uint64_t tick, uint64_t id, DeathCause cause, uint64_t age, const Point& pos);
+
+	private:
+		struct Event {
+			uint64_t tick;
+			uint64_t id;
+			uint64_t ref;
+			uint32_t x, y;
+			uint8_t type;
+			uint8_t detail;
+		};
+
+		// Single producer, single consumer
+		struct Ring {
+			static constexpr size_t capacity = 1 << 14;
+			std::unique_ptr<Event[]> events = std::make_unique<Event[]>(capacity);
+			// Written by producer
+			alignas(64) std::atomic<size_t> head {0};
+			// Written by writer thread
+			alignas(64) std::atomic<size_t> tail {0};
+			// Thread pushing into this ring, set once under ringsLock
+			std::thread::id owner;
+		};
+
+		// Distinguishes logs in threads' ring caches, addresses might get reused
+		const uint64_t instance;
+
+		std::ofstream out;
+
+		std::mutex ringsLock;
+		std::vector<std::unique_ptr<Ring>> rings;
+
+		std::atomic<bool> stop {false};
+		std::mutex wakeLock;
+		std::condition_variable wake;
+		std::thread writer;
+
+		// Each thread gets one ring per log, no matter how often it switches between logs
+		Ring& threadRing();
+		void push(const Event& ev);
+		// Returns amount of written events
+		size_t drain(std::vector<char>& buffer);
+		void writerLoop();
+};
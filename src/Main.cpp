@@ -1,9 +1,21 @@
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <optional>
 #include <sstream>
+#include <thread>
 #include <unordered_set>
 
 #include "Global.hpp"
 #include "Cell.hpp"
+#include "World.hpp"
+#include "Ensemble.hpp"
+#include "Verify.hpp"
+#include "Profiler.hpp"
+#include "Remote.hpp"
+#include "Render.hpp"
 #include "SdlUtils.hpp"
 #include <SDL_main.h>
 #include <SDL2_framerate.h>
@@ -13,14 +25,245 @@
 #include <omp.h>
 #endif
 
-GlobalSettingsType global;
-GlobalFieldType field;
-
 [[noreturn]] static void PrintUsageAndExit([[maybe_unused]] int argc, char* argv[]) {
-	SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "Usage: %s WIDTH HEIGHT", argv[0]);
+	SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "Usage: %s WIDTH HEIGHT [OPTIONS]", argv[0]);
+	SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "       %s --ensemble SPEC OUTDIR [THREADS]", argv[0]);
+	SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "       %s --verify WIDTH HEIGHT TICKS [SEED]", argv[0]);
+	SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "Options:");
+	SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "  --lineage FILE    write births and deaths to FILE");
+	SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "  --restore FILE    start from checkpoint");
+	SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "  --seed-population DENSITY  fill this share of empty slots with cells at start");
+	SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "  --bank FILE       take seeded programs from genome bank instead of random ones");
+	SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "  --density-map FILE  scale seeding density by PGM image");
+	SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "  --max-population N  throttle divisions as population approaches N cells");
+	SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "  --max-memory MB   throttle divisions as estimated memory usage approaches MB megabytes");
+	SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "  --telemetry FILE  write statistics history to FILE on exit, JSON if name ends with .json, CSV otherwise");
+	SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "  --no-fast-forward  interpret every instruction, even of cells stuck in closed loops");
+	SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "  --headless        run without window until interrupted or told to quit");
+#ifdef WITH_REMOTE
+	SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "  --control SOCKET  accept commands on Unix socket");
+	SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "  --shm NAME        publish frames and statistics to shared memory");
+#endif
 	exit(EXIT_FAILURE);
 };
 
+struct RunOptions {
+	const char* lineagePath = nullptr;
+	const char* restorePath = nullptr;
+	std::optional<double> seedDensity;
+	const char* bankPath = nullptr;
+	const char* densityMapPath = nullptr;
+	size_t populationCap = 0;
+	size_t memoryCapMb = 0;
+	const char* controlPath = nullptr;
+	const char* shmName = nullptr;
+	const char* telemetryPath = nullptr;
+	bool fastForward = true;
+	bool headless = false;
+};
+
+// Shared by all threads, only changed by master thread between ticks
+struct RunState {
+	bool working = true;
+	bool paused = false;
+};
+
+static void PrintMemoryUsage(std::ostream& out, const World& world) {
+	auto usage = world.memoryUsage();
+	auto kib = [](size_t bytes) { return (bytes + 1023) / 1024; };
+	out << "Memory: " << kib(usage.total()) << " KiB (cells " << kib(usage.cells) << ", genomes " << kib(usage.genomes)
+		<< ", index " << kib(usage.index) << ", grids " << kib(usage.grids) << ", buffers " << kib(usage.buffers) << ")";
+	if (world.populationCap or world.memoryCap) {
+		out << ", population limit " << world.populationLimit() << ", throttled births " << world.getThrottledBirths();
+	}
+	out << "\n";
+}
+
+static std::vector<GenomeBankEntry> LoadGenomeBank(const std::string& path) {
+	std::ifstream in(path);
+	if (!in) throw std::runtime_error("Can't open " + path);
+	auto bank = readGenomeBank(in);
+	if (bank.empty()) throw std::runtime_error("Genome bank " + path + " is empty");
+	return bank;
+}
+
+static void SaveGenomeBank(const World& world, const std::string& path, size_t limit) {
+	std::ofstream out(path);
+	if (!out) throw std::runtime_error("Can't open " + path + " for writing");
+	out << "# Exported on tick " << world.getTickCount() << "\n";
+	writeGenomeBank(out, world.exportGenomes(limit));
+	if (!out) throw std::runtime_error("Failed writing " + path);
+}
+
+static void SaveTelemetry(const World& world, const std::string& path) {
+	if (!world.telemetry) throw std::runtime_error("Telemetry is not recorded");
+	std::ofstream out(path);
+	if (!out) throw std::runtime_error("Can't open " + path + " for writing");
+	bool json = path.size() >= 5 and path.compare(path.size() - 5, 5, ".json") == 0;
+	if (json) world.telemetry->writeJson(out);
+	else world.telemetry->writeCsv(out);
+	if (!out) throw std::runtime_error("Failed writing " + path);
+}
+
+#ifdef WITH_REMOTE
+// Publish to shared memory feed every this many ticks
+static constexpr size_t feedInterval = 16;
+
+// Control socket commands, reply is "OK ..." or "ERR message":
+//   stats                  - current statistics
+//   spawn [COUNT]          - place COUNT (10 by default) cells with empty programs
+//   mutation [RATE]        - get or set mutation rate
+//   limit [population N | memory MB]  - get or set ceilings, 0 removes one
+//   pause, resume
+//   checkpoint FILE        - save state, use with --restore
+//   seed DENSITY [BANK]    - fill this share of empty slots with cells, random or from genome bank
+//   export FILE [COUNT]    - write COUNT (100 by default) most numerous strains to genome bank
+//   telemetry FILE         - write statistics history, JSON if name ends with .json, CSV otherwise
+//   quit
+static std::string HandleCommand(World& world, RunState& state, const std::string& line) {
+	std::istringstream stream {line};
+	std::string command;
+	stream >> command;
+	try {
+		std::ostringstream reply;
+		reply << "OK";
+		if (command == "stats") {
+			auto stats = world.collectStats();
+			const auto& census = world.getCensus();
+			reply << " tick=" << world.getTickCount() << " population=" << stats.population
+				<< " energy=" << stats.totalEnergy << " power=" << stats.totalPower
+				<< " strains=" << census.richness() << " shannon=" << census.shannon()
+				<< " mutation=" << world.mutationRate << " paused=" << state.paused;
+			auto usage = world.memoryUsage();
+			reply << " memory=" << usage.total() << " memory.cells=" << usage.cells << " memory.genomes=" << usage.genomes
+				<< " memory.index=" << usage.index << " memory.grids=" << usage.grids << " memory.buffers=" << usage.buffers
+				<< " throttled=" << world.getThrottledBirths() << " parked=" << world.getParkedCells();
+		} else if (command == "spawn") {
+			size_t cnt;
+			if (!(stream >> cnt)) cnt = 10;
+			world.spawnRandomCells(cnt);
+		} else if (command == "mutation") {
+			size_t rate;
+			if (stream >> rate) world.mutationRate = rate;
+			reply << " mutation=" << world.mutationRate;
+		} else if (command == "limit") {
+			std::string kind;
+			size_t val;
+			if (stream >> kind) {
+				if (!(stream >> val)) return "ERR limit needs value";
+				if (kind == "population") world.populationCap = val;
+				else if (kind == "memory") world.memoryCap = val << 20;
+				else return "ERR unknown limit: " + kind;
+			}
+			reply << " population=" << world.populationCap << " memory=" << (world.memoryCap >> 20);
+		} else if (command == "pause") {
+			state.paused = true;
+		} else if (command == "resume") {
+			state.paused = false;
+		} else if (command == "checkpoint") {
+			std::string path;
+			if (!(stream >> path)) return "ERR checkpoint needs file name";
+			std::ofstream out(path, std::ios::binary);
+			if (!out) return "ERR can't open " + path;
+			world.saveCheckpoint(out);
+			reply << " tick=" << world.getTickCount();
+		} else if (command == "seed") {
+			SeedSpec spec;
+			std::string bankPath;
+			if (!(stream >> spec.density)) return "ERR seed needs density";
+			if (stream >> bankPath) spec.bank = LoadGenomeBank(bankPath);
+			reply << " placed=" << world.seedPopulation(spec);
+		} else if (command == "export") {
+			std::string path;
+			size_t limit;
+			if (!(stream >> path)) return "ERR export needs file name";
+			if (!(stream >> limit)) limit = 100;
+			SaveGenomeBank(world, path, limit);
+		} else if (command == "telemetry") {
+			std::string path;
+			if (!(stream >> path)) return "ERR telemetry needs file name";
+			SaveTelemetry(world, path);
+		} else if (command == "quit") {
+			state.working = false;
+		} else {
+			return "ERR unknown command: " + command;
+		}
+		return reply.str();
+	} catch (const std::exception& e) {
+		return std::string("ERR ") + e.what();
+	}
+}
+#endif
+
+static volatile std::sig_atomic_t interrupted = 0;
+
+static void OnInterrupt(int) {
+	interrupted = 1;
+}
+
+// Headless mode: run many independent worlds at once, see Ensemble.hpp for spec format
+static int EnsembleMain(int argc, char* argv[]) {
+	if (argc != 4 and argc != 5) PrintUsageAndExit(argc, argv);
+
+	size_t threads = std::thread::hardware_concurrency();
+	if (argc == 5) {
+		std::istringstream stream {argv[4]};
+		stream >> threads;
+		if (!stream) PrintUsageAndExit(argc, argv);
+	}
+
+	try {
+		std::ifstream spec(argv[2]);
+		if (!spec) throw std::runtime_error(std::string("Can't open ") + argv[2]);
+		auto members = parseEnsembleSpec(spec);
+		runEnsemble(members, argv[3], threads);
+#ifdef WITH_PROFILER
+		Profiler::report(std::cout, true);
+#endif
+	} catch (const std::exception& e) {
+		SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "%s", e.what());
+		return 1;
+	}
+	return 0;
+}
+
+// Headless mode: check fast paths against reference implementation, see Verify.hpp
+static int VerifyMain(int argc, char* argv[]) {
+	if (argc < 5 or argc > 6) PrintUsageAndExit(argc, argv);
+
+	VerifySpec spec;
+	{
+		std::istringstream stream {std::string(argv[2]) + " " + argv[3] + " " + argv[4]};
+		stream >> spec.fieldW >> spec.fieldH >> spec.ticks;
+		if (!stream or spec.fieldW == 0 or spec.fieldH == 0) PrintUsageAndExit(argc, argv);
+	}
+	if (argc >= 6) {
+		std::istringstream stream {argv[5]};
+		stream >> spec.seed;
+		if (!stream) PrintUsageAndExit(argc, argv);
+	} else {
+		spec.seed = std::random_device()();
+	}
+
+	try {
+		SDL_Log("Verifying %zux%zu world%s, seed %lu", spec.fieldW, spec.fieldH, spec.fastForward ? " with fast-forward" : "",
+				(unsigned long)spec.seed);
+		auto result = runVerification(spec);
+		auto rate = [&result](double seconds) { return (seconds > 0) ? result.cellTicks / seconds / 1e6 : 0.0; };
+		SDL_Log("%zu cell-ticks: reference %.3f s (%.2f M/s), candidate %.3f s (%.2f M/s)", result.cellTicks,
+				result.referenceSeconds, rate(result.referenceSeconds), result.candidateSeconds, rate(result.candidateSeconds));
+		if (result.divergence) {
+			SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Diverged after %zu matching ticks. %s", result.ticksMatched, result.divergence->c_str());
+			return 1;
+		}
+		SDL_Log("Identical for all %zu ticks", result.ticksMatched);
+	} catch (const std::exception& e) {
+		SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "%s", e.what());
+		return 1;
+	}
+	return 0;
+}
+
 Uint32 my_callbackfunc([[maybe_unused]] Uint32 interval, [[maybe_unused]] void *param) {
 	SDL_Event event;
 	SDL_UserEvent userevent;
@@ -42,19 +285,145 @@ Uint32 my_callbackfunc([[maybe_unused]] Uint32 interval, [[maybe_unused]] void *
 
 int main(int argc, char* argv[]) {
 	// TODO: use option handling library
-	if (argc != 3) PrintUsageAndExit(argc, argv);
+	if (argc >= 2 and !strcmp(argv[1], "--ensemble")) return EnsembleMain(argc, argv);
+	if (argc >= 2 and !strcmp(argv[1], "--verify")) return VerifyMain(argc, argv);
+	if (argc < 3) PrintUsageAndExit(argc, argv);
 
+	size_t fieldW, fieldH;
 	{
 		std::istringstream stream1 {argv[1]}, stream2 {argv[2]};
-		stream1 >> global.fieldW;
-		stream2 >> global.fieldH;
+		stream1 >> fieldW;
+		stream2 >> fieldH;
 		if (!stream1 or !stream2) PrintUsageAndExit(argc, argv);
 	}
 
+	RunOptions options;
+	for (int i = 3; i < argc; ++i) {
+		if (!strcmp(argv[i], "--lineage") and i + 1 < argc) options.lineagePath = argv[++i];
+		else if (!strcmp(argv[i], "--restore") and i + 1 < argc) options.restorePath = argv[++i];
+		else if (!strcmp(argv[i], "--seed-population") and i + 1 < argc) {
+			std::istringstream stream {argv[++i]};
+			double density;
+			stream >> density;
+			if (!stream or density < 0 or density > 1) PrintUsageAndExit(argc, argv);
+			options.seedDensity = density;
+		}
+		else if (!strcmp(argv[i], "--bank") and i + 1 < argc) options.bankPath = argv[++i];
+		else if (!strcmp(argv[i], "--density-map") and i + 1 < argc) options.densityMapPath = argv[++i];
+		else if ((!strcmp(argv[i], "--max-population") or !strcmp(argv[i], "--max-memory")) and i + 1 < argc) {
+			auto& cap = !strcmp(argv[i], "--max-population") ? options.populationCap : options.memoryCapMb;
+			std::istringstream stream {argv[++i]};
+			stream >> cap;
+			if (!stream) PrintUsageAndExit(argc, argv);
+		}
+		else if (!strcmp(argv[i], "--telemetry") and i + 1 < argc) options.telemetryPath = argv[++i];
+		else if (!strcmp(argv[i], "--no-fast-forward")) options.fastForward = false;
+		else if (!strcmp(argv[i], "--headless")) options.headless = true;
+#ifdef WITH_REMOTE
+		else if (!strcmp(argv[i], "--control") and i + 1 < argc) options.controlPath = argv[++i];
+		else if (!strcmp(argv[i], "--shm") and i + 1 < argc) options.shmName = argv[++i];
+#endif
+		else PrintUsageAndExit(argc, argv);
+	}
+	if ((options.bankPath or options.densityMapPath) and !options.seedDensity) PrintUsageAndExit(argc, argv);
+
 	try {
 		// Init things
-		field.lightMap = std::make_unique<uint8_t[]> (global.fieldH * global.fieldW);
-		field.cellsField = std::make_unique<Cell*[]>(global.fieldH * global.fieldW);
+		std::random_device rng_dev;
+		World world(fieldW, fieldH, rng_dev());
+		world.bind();
+		world.populationCap = options.populationCap;
+		world.memoryCap = options.memoryCapMb << 20;
+		world.fastForward = options.fastForward;
+		world.telemetry = std::make_shared<Telemetry>();
+		if (options.lineagePath) world.lineage = std::make_shared<LineageLog>(options.lineagePath, fieldW, fieldH);
+		if (options.restorePath) {
+			std::ifstream in(options.restorePath, std::ios::binary);
+			if (!in) throw std::runtime_error(std::string("Can't open ") + options.restorePath);
+			world.loadCheckpoint(in);
+		}
+		if (options.seedDensity) {
+			SeedSpec spec;
+			spec.density = *options.seedDensity;
+			if (options.bankPath) spec.bank = LoadGenomeBank(options.bankPath);
+			if (options.densityMapPath) {
+				std::ifstream in(options.densityMapPath, std::ios::binary);
+				if (!in) throw std::runtime_error(std::string("Can't open ") + options.densityMapPath);
+				spec.densityMap = readDensityMap(in, fieldW, fieldH);
+			}
+			auto startTime = SDL_GetTicks();
+			auto placed = world.seedPopulation(spec);
+			SDL_Log("Seeded %zu cells in %u ms", placed, SDL_GetTicks() - startTime);
+		}
+
+		RunState state;
+#ifdef WITH_REMOTE
+		std::unique_ptr<ControlServer> control;
+		if (options.controlPath) control = std::make_unique<ControlServer>(options.controlPath);
+		std::unique_ptr<SharedFeed> feed;
+		if (options.shmName) feed = std::make_unique<SharedFeed>(options.shmName, fieldW, fieldH);
+		size_t lastPublished = -1;
+#endif
+		// Called by master thread between ticks. Waits up to `timeoutMs` for commands if there are none.
+		auto serviceRemote = [&]([[maybe_unused]] int timeoutMs) {
+#ifdef WITH_REMOTE
+			if (control) {
+				control->poll([&world, &state](const std::string& command) {
+					return HandleCommand(world, state, command);
+				}, timeoutMs);
+			}
+			auto tick = world.getTickCount();
+			if (feed and tick % feedInterval == 0 and tick != lastPublished) {
+				feed->publish(world);
+				lastPublished = tick;
+			}
+#endif
+		};
+
+		if (options.headless) {
+			std::signal(SIGINT, OnInterrupt);
+			std::signal(SIGTERM, OnInterrupt);
+#ifdef WITH_OPENMP
+			#pragma omp parallel
+			try {
+#endif
+				world.bind();
+				while (true) {
+#ifdef WITH_OPENMP
+					#pragma omp master
+#endif
+					{
+						// Sleep on control socket instead of spinning while paused
+						serviceRemote(state.paused ? 100 : 0);
+						if (interrupted) state.working = false;
+					}
+#ifdef WITH_OPENMP
+					#pragma omp barrier
+#endif
+					if (!state.working) break;
+					if (state.paused) {
+						// Keep master from changing state until everyone has seen it
+#ifdef WITH_OPENMP
+						#pragma omp barrier
+#endif
+						continue;
+					}
+					world.tick();
+				}
+#ifdef WITH_OPENMP
+			} catch (const std::exception& e) {
+				SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "(in threaded loop) %s", e.what());
+				exit(1);
+			}
+#endif
+			if (options.telemetryPath) SaveTelemetry(world, options.telemetryPath);
+#ifdef WITH_PROFILER
+			Profiler::report(std::cout, true);
+#endif
+			return 0;
+		}
+
+		auto fillView = pickFillView(fieldW, fieldH);
 
 		atexit(SDL_Quit);
 		if (SDL_Init(SDL_INIT_EVENTS | SDL_INIT_VIDEO)) throw SdlError();
@@ -71,114 +440,154 @@ int main(int argc, char* argv[]) {
 										   SDL_RENDERER_TARGETTEXTURE
 										  );
 
-		// Texture we're rendering to. 1 field is exactly 1 pixel. Locking is used to send data.
+		// Texture we're rendering to. It holds one texel per visible sample (slot or aggregated block)
+		// and is as big as the window at most, no matter how large the world is. Locking is used to send data.
+		// Window's own format is used when possible so that driver doesn't have to convert anything.
 		SDL_SetHintWithPriority(SDL_HINT_RENDER_SCALE_QUALITY, "nearest", SDL_HINT_OVERRIDE);
-		auto renderTexture = sdl_resource(SDL_CreateTexture, SDL_DestroyTexture,
-										  windowRenderer.get(), SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STREAMING, global.fieldW, global.fieldH
-										 );
-
-		// "Midway" texture that's used to render with better quality
-		// It gets recreated when `scaleFactor` is changed
-		SDL_SetHintWithPriority(SDL_HINT_RENDER_SCALE_QUALITY, "linear", SDL_HINT_OVERRIDE);
-		size_t scaleFactor;
-		auto updateScaleFactor = [&scaleFactor, &windowRenderer]() {
+		Uint32 textureFormat = SDL_GetWindowPixelFormat(window.get());
+		auto pixelLayout = pixelLayoutFor(textureFormat);
+		if (!pixelLayout) {
+			textureFormat = SDL_PIXELFORMAT_ARGB8888;
+			pixelLayout = pixelLayoutFor(textureFormat);
+		}
+		Viewport viewport(fieldW, fieldH);
+		std::unique_ptr<SDL_Texture, decltype(&SDL_DestroyTexture)> viewTexture {nullptr, SDL_DestroyTexture};
+		auto updateWindowSize = [&viewport, &viewTexture, &windowRenderer, textureFormat]() {
 			int w, h;
 			if (SDL_GetRendererOutputSize(windowRenderer.get(), &w, &h)) throw SdlError();
-			scaleFactor = std::min(
-							  1 + ((w - 1) / global.fieldW),
-							  1 + ((h - 1) / global.fieldH)
-						  );
-		};
-		updateScaleFactor();
-		auto scaleTexture = sdl_resource(SDL_CreateTexture, SDL_DestroyTexture,
-										 windowRenderer.get(), SDL_GetWindowPixelFormat(window.get()), SDL_TEXTUREACCESS_TARGET,
-										 global.fieldW * scaleFactor, global.fieldH * scaleFactor
-										);
-
-		SDL_RenderSetLogicalSize(windowRenderer.get(), global.fieldW * scaleFactor, global.fieldH * scaleFactor);
-
-		// Setup random number generators, one per thread
-#ifdef WITH_OPENMP
-		size_t threads = omp_get_max_threads();
-		auto rngs = std::make_unique<randomGenerator[]>(threads);
-		#pragma omp parallel for
-		for (size_t i = 0; i < threads; ++i) {
-			std::random_device rng_dev;
-			rngs[i].seed(rng_dev());
+			viewport.resize(w, h);
+			viewTexture = sdl_resource(SDL_CreateTexture, SDL_DestroyTexture,
+									   windowRenderer.get(), textureFormat, SDL_TEXTUREACCESS_STREAMING, std::max(w, 1), std::max(h, 1)
+									  );
 		};
-#else
-		randomGenerator rng;
-		{
-			std::random_device rng_dev;
-			rng.seed(rng_dev());
-		}
-#endif
+		updateWindowSize();
+		viewport.fit();
+		bool dragging = false;
 
 		// Setup FPS manager
 		FPSmanager fps;
 		SDL_initFramerate(&fps);
 		SDL_setFramerate(&fps, 60);
-		size_t frame_count = 0, fps_frame_count = 0;
-
-		// Various variables that affect how simulation is working
-		size_t mutationRate = 10;
-
-		// Those vectors get reused a lot, so don't create them every loop
-		std::vector<std::pair<Point, Cell*>> moves;
-		std::vector<std::pair<Point, CellActionRequest*>> energyts;
-		std::vector<std::pair<Point, CellActionRequest*>> eats;
-
-		std::vector<Point> divisions;
-		std::vector<Point> todie;
+		size_t fps_frame_count = 0;
+#ifdef WITH_PROFILER
+		size_t profilerSeconds = 0;
+#endif
 
 		// We're all set, let's go!
-		bool working = true;
 		auto fpsTime = SDL_GetTicks();
 		SDL_AddTimer(1000, my_callbackfunc, nullptr);
 #ifdef WITH_OPENMP
 		#pragma omp parallel
 		try {
 			// Style guide: tasks and taskloops must use default(none) to strictly control variable access
-			// Note: must not be used in tasks. Each must get an individual copy instead.
-			auto& rng = rngs[omp_get_thread_num()];
 #endif
-			while (working) {
+			world.bind();
+			while (state.working) {
 				// Input events handling
 #ifdef WITH_OPENMP
 				#pragma omp master
 #endif
 				{
+					serviceRemote(0);
 					SDL_Event e;
 					while (SDL_PollEvent(&e)) {
 						switch (e.type) {
 						case SDL_QUIT:
-							working = false;
+							state.working = false;
 							break;
 						case SDL_KEYDOWN:
 							if (!e.key.repeat)
 								switch (e.key.keysym.scancode) {
 								case SDL_SCANCODE_A: {
 									std::cout << "Here, have some cells!" << std::endl;
-									std::uniform_int_distribution<size_t> wDist(0, global.fieldW - 1);
-									std::uniform_int_distribution<size_t> hDist(0, global.fieldH - 1);
-									for (size_t i = 0; i < 10; ++i) {
-										auto pos = Point(hDist(rng), wDist(rng));
-										auto newCell = std::make_unique<Cell>();
-										field.cellsField[pos.toArrayIdx()] = newCell.get();
-										field.cellsMap.emplace(pos, std::move(newCell));
+									world.spawnRandomCells(10);
+									break;
+								}
+								case SDL_SCANCODE_HOME:
+									viewport.fit();
+									break;
+								case SDL_SCANCODE_PAGEUP:
+								case SDL_SCANCODE_PAGEDOWN: {
+									int w, h;
+									SDL_GetRendererOutputSize(windowRenderer.get(), &w, &h);
+									viewport.zoomAt((e.key.keysym.scancode == SDL_SCANCODE_PAGEUP) ? 1 : -1, w / 2, h / 2);
+									break;
+								}
+								case SDL_SCANCODE_LEFT:
+								case SDL_SCANCODE_RIGHT:
+								case SDL_SCANCODE_UP:
+								case SDL_SCANCODE_DOWN: {
+									// Move by an eighth of the window
+									int w, h;
+									SDL_GetRendererOutputSize(windowRenderer.get(), &w, &h);
+									switch (e.key.keysym.scancode) {
+									case SDL_SCANCODE_LEFT:
+										viewport.pan(w / 8, 0);
+										break;
+									case SDL_SCANCODE_RIGHT:
+										viewport.pan(-w / 8, 0);
+										break;
+									case SDL_SCANCODE_UP:
+										viewport.pan(0, h / 8);
+										break;
+									default:
+										viewport.pan(0, -h / 8);
+										break;
+									}
+									break;
+								}
+								case SDL_SCANCODE_S: {
+									const auto& census = world.getCensus();
+									std::cout << "Strains: " << census.richness() << ", Shannon index: " << census.shannon() << "\n";
+									auto flags = std::cout.flags();
+									for (const auto& strain : census.top(5)) {
+										std::cout << "  " << std::hex << std::setw(16) << std::setfill('0') << strain.genome << std::dec << std::setfill(' ')
+											<< "  " << strain.count << " cells since tick " << strain.firstSeen << "\n";
+									}
+									std::cout.flags(flags);
+									std::cout.flush();
+									break;
+								}
+								case SDL_SCANCODE_M: {
+									PrintMemoryUsage(std::cout, world);
+									std::cout.flush();
+									break;
+								}
+								case SDL_SCANCODE_E: {
+									auto path = "genomes-" + std::to_string(world.getTickCount()) + ".txt";
+									try {
+										SaveGenomeBank(world, path, 100);
+										std::cout << "Exported genome bank to " << path << std::endl;
+									} catch (const std::exception& e) {
+										SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "%s", e.what());
+									}
+									break;
+								}
+								case SDL_SCANCODE_T: {
+									auto path = "telemetry-" + std::to_string(world.getTickCount()) + ".csv";
+									try {
+										SaveTelemetry(world, path);
+										std::cout << "Exported telemetry to " << path << std::endl;
+									} catch (const std::exception& e) {
+										SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "%s", e.what());
 									}
 									break;
 								}
+								case SDL_SCANCODE_P: {
+									state.paused = !state.paused;
+									std::cout << (state.paused ? "Paused" : "Resumed") << std::endl;
+									break;
+								}
 								case SDL_SCANCODE_KP_PLUS: {
-									if (mutationRate >= 5) mutationRate += 5;
-									else mutationRate += 1;
-									std::cout << "Mutation rate: " << mutationRate << std::endl;
+									if (world.mutationRate >= 5) world.mutationRate += 5;
+									else world.mutationRate += 1;
+									std::cout << "Mutation rate: " << world.mutationRate << std::endl;
 									break;
 								}
 								case SDL_SCANCODE_KP_MINUS: {
-									if (mutationRate > 5) mutationRate -= 5;
-									else if (mutationRate > 0) mutationRate -= 1;
-									std::cout << "Mutation rate: " << mutationRate << std::endl;
+									if (world.mutationRate > 5) world.mutationRate -= 5;
+									else if (world.mutationRate > 0) world.mutationRate -= 1;
+									std::cout << "Mutation rate: " << world.mutationRate << std::endl;
 									break;
 								}
 								default:
@@ -186,312 +595,45 @@ int main(int argc, char* argv[]) {
 								}
 						case SDL_WINDOWEVENT:
 							if (e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
-								size_t oldScale = scaleFactor;
-								updateScaleFactor();
-								if (oldScale != scaleFactor) {
-									scaleTexture = sdl_resource(SDL_CreateTexture, SDL_DestroyTexture,
-																windowRenderer.get(), SDL_GetWindowPixelFormat(window.get()), SDL_TEXTUREACCESS_TARGET,
-																global.fieldW * scaleFactor, global.fieldH * scaleFactor
-															   );
-									SDL_RenderSetLogicalSize(windowRenderer.get(), global.fieldW * scaleFactor, global.fieldH * scaleFactor);
-								}
+								updateWindowSize();
 							}
 							break;
+						case SDL_MOUSEWHEEL: {
+							int mouseX, mouseY;
+							SDL_GetMouseState(&mouseX, &mouseY);
+							viewport.zoomAt(e.wheel.y, mouseX, mouseY);
+							break;
+						}
+						case SDL_MOUSEBUTTONDOWN:
+						case SDL_MOUSEBUTTONUP:
+							if (e.button.button == SDL_BUTTON_LEFT) dragging = (e.type == SDL_MOUSEBUTTONDOWN);
+							break;
+						case SDL_MOUSEMOTION:
+							if (dragging) viewport.pan(e.motion.xrel, e.motion.yrel);
+							break;
 						case SDL_USEREVENT:
 							auto timeNow = SDL_GetTicks();
 							std::cout << "FPS: " << double(fps_frame_count * 1000) / double(timeNow - fpsTime) << "\n";
 							fpsTime = timeNow;
 							fps_frame_count = 0;
+#ifdef WITH_PROFILER
+							if (++profilerSeconds % 10 == 0) Profiler::report(std::cout, false);
+#endif
 						};
 					};
 				}
 #ifdef WITH_OPENMP
 				#pragma omp barrier
 #endif
-				if (!working) break;
-
-				// Round 1 of calculations: poll cells for actions
+				if (!state.working) break;
 
+				if (state.paused) {
+					// Keep master from changing state until everyone has seen it
 #ifdef WITH_OPENMP
-				#pragma omp sections
+					#pragma omp barrier
 #endif
-				{
-#ifdef WITH_OPENMP
-					#pragma omp section
-#endif
-					moves.clear();
-#ifdef WITH_OPENMP
-					#pragma omp section
-#endif
-					energyts.clear();
-#ifdef WITH_OPENMP
-					#pragma omp section
-#endif
-					eats.clear();
-				}
-
-#ifdef WITH_OPENMP
-				#pragma omp single
-#endif
-				{
-					for (auto& pair : field.cellsMap) {
-
-#ifdef WITH_OPENMP
-						#pragma omp task shared(pair) shared(moves, energyts, eats) default(none)
-#endif
-						{
-							auto res = pair.second->advanceBegin(pair.first);
-							if (res) {
-								switch (res->type) {
-								case CellActionRequestType::MOVE:
-#ifdef WITH_OPENMP
-									#pragma omp critical(moves)
-#endif
-									moves.emplace_back(pair.first, pair.second.get());
-									break;
-								case CellActionRequestType::ENERGY:
-#ifdef WITH_OPENMP
-									#pragma omp critical(energyts)
-#endif
-									energyts.emplace_back(pair.first, res);
-									break;
-								case CellActionRequestType::EAT:
-#ifdef WITH_OPENMP
-									#pragma omp critical(eats)
-#endif
-									eats.emplace_back(pair.first, res);
-									break;
-
-								case CellActionRequestType::NONE:
-									abort(); // Something is wrong
-									break;
-								}
-							}
-						}
-					}
-#ifdef WITH_OPENMP
-					#pragma omp taskwait
-#endif
-				}
-
-#ifdef WITH_OPENMP
-				#pragma omp single
-#endif
-				{
-					// Round two: handle energy transfers, eating and movement
-					// This includes changing state of cells, so we do this single-threaded (sadly)
-					// TODO: shuffling vectors first might be a good idea
-
-					// Energy transfers don't invalidate anything
-					for (auto& req : energyts) {
-						const auto second = req.second;
-						req.first.checkBounds();
-						if (!req.first.apply(second->dir)) abort();
-						field.cellsField[req.first.toArrayIdx()]->addEnergy(second->num);
-						second->res = 1;
-					}
-
-					// Eating requests might destroy source or target cells, so check for them first
-					for (auto& req : eats) {
-						req.first.checkBounds();
-						// Are we still there?
-						auto eater = field.cellsField[req.first.toArrayIdx()];
-						if (eater) {
-							const auto second = req.second;
-							if (!req.first.apply(second->dir)) abort();
-
-							// Is our eating target still there?
-							auto prey = field.cellsField[req.first.toArrayIdx()];
-							if (prey) {
-								// It is. Good
-								bool canEat = false;
-
-								auto getPotential = [](decltype(eater)& obj) {
-									return obj->getEnergy() + obj->getPower();
-								};
-
-								auto eaterPotential = getPotential(eater);
-								auto preyPotential = getPotential(prey);
-
-								if (eaterPotential < preyPotential) {
-									uint8_t diff = preyPotential - eaterPotential;
-
-									std::uniform_int_distribution<uint8_t> dist(0, diff);
-									// This affects how useful eating is in general
-									canEat = dist(rng) < 25;
-								} else {
-									canEat = true;
-								}
-								second->res = canEat;
-
-								if (canEat) {
-									// We ate 'em!
-									// Add from half to all of their energy to us and erase them
-									//std::cout << "Om nom nom\n";
-									std::uniform_int_distribution<uint8_t> dist(prey->getEnergy() / 2, prey->getEnergy());
-									eater->addEnergy(dist(rng));
-									field.cellsMap.erase(req.first);
-									field.cellsField[req.first.toArrayIdx()] = nullptr;
-								}
-							} else {
-								second->res = 0;
-							}
-							// No outer else needed, the eater is gone by now
-						}
-					}
-
-					// Now movement requests
-					// Check both for existance of asker and possiblity of request
-					// Also note that movement invalidates action pointers of moved cells, so be extra careful
-					for (auto& reqPair : moves) {
-						// Are we still there? Is that still really us?
-						auto cell = reqPair.second;
-						auto posIdx = reqPair.first.toArrayIdx();
-						if (field.cellsField[posIdx] and field.cellsField[posIdx] == cell) {
-							const auto req = cell->getActionPtr();
-							const auto origPos = reqPair.first;
-							if (!reqPair.first.apply(req->dir)) abort();
-							// Ensure that target space is empty
-							if (!field.cellsField[reqPair.first.toArrayIdx()]) {
-								req->res = 1;
-								reqPair.first.checkBounds();
-								field.cellsMap.emplace(reqPair.first, std::move(field.cellsMap.at(origPos)));
-								field.cellsMap.erase(origPos);
-								field.cellsField[reqPair.first.toArrayIdx()] = field.cellsField[posIdx];
-								field.cellsField[posIdx] = nullptr;
-							} else {
-								req->res = 0;
-							}
-						}
-					}
-				}
-				// Implicit OpenMP barrier
-
-				// Calculate lighting
-				// Note: we might render blue component to texture as the same time
-				// It could increase performance, but how much?..
-				uint8_t maxLight;
-				{
-					size_t daytime = frame_count % 256;
-					if (daytime < 128) maxLight = 255 - daytime;
-					else maxLight = daytime;
-				}
-#ifdef WITH_OPENMP
-#if defined(__GNUC__) && (__GNUC__ < 10)
-				#pragma omp for nowait
-#else
-				#pragma omp for nowait order(concurrent)
-#endif
-#endif
-				for (size_t x = 0; x < global.fieldW; ++x) {
-					size_t lightLevel = maxLight;
-
-					for (size_t y = 0; y < global.fieldH; ++y) {
-						field.lightMap[Point(y, x).toArrayIdx()] = lightLevel;
-						// TODO: make shadow proportional to cell's power
-						std::uniform_int_distribution distr(0, 1);
-						size_t change = (field.cellsField[Point(y, x).toArrayIdx()] ? 6 : 3) + distr(rng);
-						lightLevel = (change < lightLevel) ? lightLevel - change : 0;
-					};
-				}
-
-				{
-					// Now finish calculations in cells
-#ifdef WITH_OPENMP
-					#pragma omp sections
-#endif
-					{
-#ifdef WITH_OPENMP
-						#pragma omp section
-#endif
-						divisions.clear();
-#ifdef WITH_OPENMP
-						#pragma omp section
-#endif
-						todie.clear();
-					}
-
-#ifdef WITH_OPENMP
-					#pragma omp single
-#endif
-					{
-						for (auto& pair : field.cellsMap) {
-#ifdef WITH_OPENMP
-							#pragma omp task shared(pair) shared(divisions, todie, rngs) default(none)
-#endif
-							{
-								// It is required to explicitly request instance when using tasks
-#ifdef WITH_OPENMP
-								auto& rng = rngs[omp_get_thread_num()];
-#endif
-								auto res = pair.second->advanceEnd(pair.first, rng);
-								switch (res) {
-								case EndMoveAction::DIVIDE:
-#ifdef WITH_OPENMP
-									#pragma omp critical(divisions)
-#endif
-									divisions.push_back(pair.first);
-									break;
-								case EndMoveAction::DIE:
-#ifdef WITH_OPENMP
-									#pragma omp critical(todie)
-#endif
-									todie.push_back(pair.first);
-									break;
-								case EndMoveAction::NONE:
-									break;
-								};
-							}
-						}
-#ifdef WITH_OPENMP
-						#pragma omp taskwait
-#endif
-					}
-
-#ifdef WITH_OPENMP
-					#pragma omp single
-#endif
-					{
-						// Now, in (sadly) single-threaded mode, handle ensuring deaths and divisions
-						for (auto& pos : todie) {
-							// It's an easy one
-							field.cellsMap.erase(pos);
-							field.cellsField[pos.toArrayIdx()] = nullptr;
-						}
-						std::uniform_int_distribution<size_t> mutDist(0, mutationRate);
-						std::array<uint8_t, DirectionMax> possibleDirs;
-						for (auto& pos : divisions) {
-							// Divisions are tricky
-							auto parent = field.cellsField[pos.toArrayIdx()];
-							// Here we build a vector of possible division directions
-							// Note: in theory, this loop can be ran in parallel. But how?.. And is it worth it?..
-							size_t possibleCnt = 0;
-							for (uint8_t dir = 0; dir < DirectionMax; ++dir) {
-								// If it's a valid cell
-								if (auto npos = pos.applyNew(Direction(dir))) {
-									// and it's empty
-									if (!field.cellsField[(*npos).toArrayIdx()]) {
-										possibleDirs[possibleCnt++] = dir;
-									}
-								}
-							}
-							// If we can't divide, we just silently loose energy
-							if (possibleCnt == 0) {
-								continue;
-							}
-
-							// Now, select random direction to divide into and do it!
-							std::uniform_int_distribution<uint8_t> dist(0, possibleCnt - 1);
-							Direction divDir {possibleDirs[dist(rng)]};
-							auto newPos = *pos.applyNew(divDir);
-							newPos.checkBounds();
-							auto newCell = parent->fork();
-							newCell->mutate(mutDist(rng), rng);
-							field.cellsField[newPos.toArrayIdx()] = newCell.get();
-							field.cellsMap.insert({newPos, std::move(newCell)});
-						}
-					}
-					// Implicit barrier
+				} else {
+					world.tick();
 				}
 
 				// Rendering
@@ -499,52 +641,26 @@ int main(int argc, char* argv[]) {
 				#pragma omp master
 #endif
 				{
-					uint8_t* pixels;
-					int pitch;
-					SDL_LockTexture(renderTexture.get(), nullptr, (void**)&pixels, &pitch);
-					// Assert below may fail even in properly working case!
-					//SDL_assert(global.fieldW * 3 == pitch);
-#ifdef WITH_OPENMP
-					#pragma omp taskloop simd collapse(2) shared(pixels, pitch, global, field) default(none)
-#endif
-					for (size_t y = 0; y < global.fieldH; ++y) {
-						for (size_t x = 0; x < global.fieldW; ++x) {
-							size_t pixidx = pitch * y + x * 3;
-							Point pos {y, x};
-
-							auto cell = field.cellsField[pos.toArrayIdx()];
-							if (cell) {
-								// RED - power
-								// GREEN - energy
-								pixels[pixidx]		= std::min((size_t)cell->getPower() * 5, (size_t)255);
-								pixels[pixidx + 1]	= cell->getEnergy();
-							} else {
-								pixels[pixidx]		= 0;
-								pixels[pixidx + 1]	= 0;
-							}
-
-							// BLUE - lighting level
-							pixels[pixidx + 2]	= field.lightMap[pos.toArrayIdx()];
-						}
+					auto view = viewport.visible();
+					SDL_SetRenderDrawColor(windowRenderer.get(), 0, 0, 0, 255);
+					SDL_RenderClear(windowRenderer.get());
+					if (view.w and view.h) {
+						SDL_Rect samples {0, 0, int(view.w), int(view.h)};
+						uint8_t* pixels;
+						int pitch;
+						SDL_LockTexture(viewTexture.get(), &samples, (void**)&pixels, &pitch);
+						fillView(view, *pixelLayout, pixels, pitch);
+						SDL_UnlockTexture(viewTexture.get());
+
+						// Scale samples up with nearest neighbour when zoomed in
+						SDL_Rect screen {view.screenX, view.screenY, int(view.w) * view.pixelSize, int(view.h) * view.pixelSize};
+						SDL_RenderCopy(windowRenderer.get(), viewTexture.get(), &samples, &screen);
 					}
-#ifdef WITH_OPENMP
-					#pragma omp taskwait
-#endif
-					SDL_UnlockTexture(renderTexture.get());
-
-					// Upscale our texture using integer NN scaling
-					SDL_SetRenderTarget(windowRenderer.get(), scaleTexture.get());
-					SDL_RenderCopy(windowRenderer.get(), renderTexture.get(), nullptr, nullptr);
-
-					// Now display it with linear downscaling
-					SDL_SetRenderTarget(windowRenderer.get(), nullptr);
-					SDL_RenderCopy(windowRenderer.get(), scaleTexture.get(), nullptr, nullptr);
 
 					SDL_RenderPresent(windowRenderer.get());
 
 					// Insert FPS-driven delay
 					//SDL_framerateDelay(&fps);
-					++frame_count;
 					++fps_frame_count;
 				}
 			}
@@ -556,6 +672,10 @@ int main(int argc, char* argv[]) {
 			SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "unknown error in threaded loop");
 			exit(2);
 		}
+#endif
+		if (options.telemetryPath) SaveTelemetry(world, options.telemetryPath);
+#ifdef WITH_PROFILER
+		Profiler::report(std::cout, true);
 #endif
 	} catch (const std::exception& e) {
 		SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "%s", e.what());
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Heap usage estimates. Containers are counted by capacity, since that's what they actually hold on to.
+
+// Typical malloc() overhead: size is stored in front of block and blocks are 16-byte aligned
+constexpr size_t heapBlockBytes(size_t size) {
+	return (size + sizeof(size_t) + 15) / 16 * 16;
+}
+
+template<typename T>
+size_t containerBytes(const std::vector<T>& vec) {
+	return vec.capacity() ? heapBlockBytes(vec.capacity() * sizeof(T)) : 0;
+}
+
+// Node of a node-based hash table: next pointer, value and (depending on hash) cached hash value
+template<typename K, typename V>
+constexpr size_t hashNodeBytes() {
+	return heapBlockBytes(sizeof(void*) + sizeof(std::pair<const K, V>) + sizeof(size_t));
+}
+
+template<typename K, typename V, typename... Rest>
+size_t containerBytes(const std::unordered_map<K, V, Rest...>& map) {
+	return heapBlockBytes(map.bucket_count() * sizeof(void*)) + map.size() * hashNodeBytes<K, V>();
+}
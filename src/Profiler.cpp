@@ -0,0 +1,231 @@
+#include "Profiler.hpp"
+
+#ifdef WITH_PROFILER
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace Profiler {
+	static const char* const opClassNames[size_t(OpClass::COUNT)] = {
+		"WAIT", "HIBERNATE", "HIB", "JMP", "MOVE", "PROBE", "ANALYZE", "SET", "COPY", "RSET", "ADD",
+		"SUB", "MUL", "INC", "DEC", "IFZ", "IFL", "EAT", "ENG", "POW", "POW2E", "FIND", "FINDE", "SKIP"
+	};
+
+	OpClass classify(uint8_t cmd) {
+		switch (cmd) {
+		case 0:
+			return OpClass::HIB;
+		case 1:
+		case 2:
+			return OpClass::JMP;
+		case 3:
+		case 4:
+			return OpClass::MOVE;
+		case 5:
+		case 6:
+			return OpClass::PROBE;
+		case 7:
+		case 8:
+			return OpClass::ANALYZE;
+		case 9:
+			return OpClass::SET;
+		case 10:
+			return OpClass::COPY;
+		case 11:
+			return OpClass::RSET;
+		case 12:
+			return OpClass::ADD;
+		case 13:
+			return OpClass::SUB;
+		case 14:
+			return OpClass::MUL;
+		case 15:
+			return OpClass::INC;
+		case 16:
+			return OpClass::DEC;
+		case 17:
+			return OpClass::IFZ;
+		case 18:
+			return OpClass::IFL;
+		case 19:
+		case 20:
+			return OpClass::EAT;
+		case 21:
+		case 22:
+			return OpClass::ENG;
+		case 23:
+			return OpClass::FIND;
+		case 24:
+			return OpClass::FINDE;
+		case 25:
+		case 26:
+			return OpClass::POW;
+		case 27:
+		case 28:
+			return OpClass::POW2E;
+		default:
+			return OpClass::SKIP;
+		}
+	}
+
+	struct GenomeCount {
+		Genome genome;
+		uint64_t executions;
+	};
+	// Keyed by genome hash
+	using GenomeTable = std::unordered_map<uint64_t, GenomeCount>;
+	// Per thread
+	static constexpr size_t maxGenomes = 4096;
+
+	// Only owning thread writes counters, so relaxed load+store is enough and avoids locked instructions
+	struct ThreadCounters {
+		std::array<std::atomic<uint64_t>, size_t(OpClass::COUNT)> executions {};
+		std::array<std::atomic<uint64_t>, size_t(OpClass::COUNT)> ticks {};
+		// Only read by report(), which must not run concurrently with recording
+		GenomeTable genomes;
+	};
+
+	struct Snapshot {
+		std::array<uint64_t, size_t(OpClass::COUNT)> executions {};
+		std::array<uint64_t, size_t(OpClass::COUNT)> ticks {};
+		GenomeTable genomes;
+	};
+
+	// Counters outlive their threads, ensemble workers are gone by the time final report is printed
+	static std::mutex registryLock;
+	static std::vector<std::shared_ptr<ThreadCounters>> registry;
+	static Snapshot lastReport;
+
+	static ThreadCounters& threadCounters() {
+		thread_local std::shared_ptr<ThreadCounters> counters = []() {
+			auto c = std::make_shared<ThreadCounters>();
+			std::lock_guard lock(registryLock);
+			registry.push_back(c);
+			return c;
+		}();
+		return *counters;
+	}
+
+	static void bump(std::atomic<uint64_t>& counter, uint64_t val) {
+		counter.store(counter.load(std::memory_order_relaxed) + val, std::memory_order_relaxed);
+	}
+
+	void record(OpClass cls, uint64_t ticks) {
+		auto& counters = threadCounters();
+		bump(counters.executions[size_t(cls)], 1);
+		bump(counters.ticks[size_t(cls)], ticks);
+	}
+
+	// Forget genomes executed no more than median
+	static void trimGenomes(GenomeTable& genomes) {
+		std::vector<uint64_t> counts;
+		counts.reserve(genomes.size());
+		for (const auto& pair : genomes) {
+			counts.push_back(pair.second.executions);
+		}
+		auto median = counts.begin() + counts.size() / 2;
+		std::nth_element(counts.begin(), median, counts.end());
+		for (auto it = genomes.begin(); it != genomes.end();) {
+			if (it->second.executions <= *median) it = genomes.erase(it);
+			else ++it;
+		}
+	}
+
+	void recordGenome(uint64_t hash, const Genome& genome) {
+		auto& genomes = threadCounters().genomes;
+		auto it = genomes.find(hash);
+		if (it == genomes.end()) {
+			if (genomes.size() >= maxGenomes) trimGenomes(genomes);
+			it = genomes.emplace(hash, GenomeCount {genome, 0}).first;
+		}
+		++it->second.executions;
+	}
+
+	static Snapshot collect() {
+		Snapshot snapshot;
+		std::lock_guard lock(registryLock);
+		for (auto& counters : registry) {
+			for (size_t i = 0; i < size_t(OpClass::COUNT); ++i) {
+				snapshot.executions[i] += counters->executions[i].load(std::memory_order_relaxed);
+				snapshot.ticks[i] += counters->ticks[i].load(std::memory_order_relaxed);
+			}
+			for (auto& pair : counters->genomes) {
+				auto& count = snapshot.genomes.try_emplace(pair.first, GenomeCount {pair.second.genome, 0}).first->second;
+				count.executions += pair.second.executions;
+			}
+		}
+		return snapshot;
+	}
+
+	void report(std::ostream& out, bool total) {
+		constexpr size_t topGenomes = 5;
+
+		auto current = collect();
+		auto delta = current;
+		if (!total) {
+			for (size_t i = 0; i < size_t(OpClass::COUNT); ++i) {
+				delta.executions[i] -= lastReport.executions[i];
+				delta.ticks[i] -= lastReport.ticks[i];
+			}
+			for (auto& pair : delta.genomes) {
+				// Genome might have been forgotten and counted anew since then
+				auto it = lastReport.genomes.find(pair.first);
+				if (it != lastReport.genomes.end() and it->second.executions <= pair.second.executions) {
+					pair.second.executions -= it->second.executions;
+				}
+			}
+			lastReport = std::move(current);
+		}
+
+		uint64_t allExecutions = 0;
+		for (auto cnt : delta.executions) {
+			allExecutions += cnt;
+		}
+		out << "Opcode profile (" << (total ? "total" : "interval") << "): " << allExecutions << " steps\n";
+		if (allExecutions == 0) return;
+
+		std::array<size_t, size_t(OpClass::COUNT)> order;
+		for (size_t i = 0; i < order.size(); ++i) {
+			order[i] = i;
+		}
+		std::sort(order.begin(), order.end(), [&delta](size_t a, size_t b) {
+			return delta.executions[a] > delta.executions[b];
+		});
+
+		auto flags = out.flags();
+		out << std::fixed << std::setprecision(1);
+		for (auto i : order) {
+			if (delta.executions[i] == 0) break;
+			out << "  " << std::setw(10) << std::left << opClassNames[i] << std::right
+				<< std::setw(14) << delta.executions[i]
+				<< std::setw(7) << 100.0 * double(delta.executions[i]) / double(allExecutions) << "%"
+				<< std::setw(10) << double(delta.ticks[i]) / double(delta.executions[i]) << " ticks/step\n";
+		}
+
+		std::vector<std::pair<const Genome*, uint64_t>> genomes;
+		genomes.reserve(delta.genomes.size());
+		for (auto& pair : delta.genomes) {
+			if (pair.second.executions) genomes.emplace_back(&pair.second.genome, pair.second.executions);
+		}
+		auto topEnd = genomes.begin() + std::min(topGenomes, genomes.size());
+		std::partial_sort(genomes.begin(), topEnd, genomes.end(), [](const auto& a, const auto& b) {
+			return a.second > b.second;
+		});
+		out << "Hot genomes (" << genomes.size() << " tracked):\n";
+		for (auto it = genomes.begin(); it != topEnd; ++it) {
+			out << "  " << std::setw(14) << it->second << "  " << std::hex << std::setfill('0');
+			for (auto byte : *it->first) {
+				out << std::setw(2) << unsigned(byte);
+			}
+			out << std::dec << std::setfill(' ') << '\n';
+		}
+		out.flags(flags);
+	}
+};
+
+#endif
@@ -0,0 +1,86 @@
+#pragma once
+
+// Optional interpreter profiler: counts executed opcodes, time spent on them and most executed genomes
+// Compiled in only with ENABLE_PROFILER, otherwise nothing here exists
+
+#ifdef WITH_PROFILER
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+namespace Profiler {
+	enum class OpClass : uint8_t {
+		WAIT, // Paying for ANALYZE
+		HIBERNATE,
+		HIB,
+		JMP,
+		MOVE,
+		PROBE,
+		ANALYZE,
+		SET,
+		COPY,
+		RSET,
+		ADD,
+		SUB,
+		MUL,
+		INC,
+		DEC,
+		IFZ,
+		IFL,
+		EAT,
+		ENG,
+		POW,
+		POW2E,
+		FIND,
+		FINDE,
+		SKIP, // Unknown opcodes, handled by `default:`
+		COUNT
+	};
+
+	using Genome = std::array<uint8_t, 127>;
+
+	OpClass classify(uint8_t cmd);
+
+	// Cycles on x86, nanoseconds elsewhere
+	inline uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+	};
+
+	// Thread-safe, counters are per-thread
+	void record(OpClass cls, uint64_t ticks);
+	// Genomes are told apart by `hash` (Cell::getGenomeHash()), `genome` is only copied when it's first seen.
+	// Every thread tracks a limited amount of them, least executed half is forgotten when table fills up.
+	void recordGenome(uint64_t hash, const Genome& genome);
+
+	// Print statistics gathered since previous interval report, or since start if `total` is set
+	// Genome tables are read without locking, so no thread may be recording meanwhile (i.e. call it between ticks).
+	void report(std::ostream& out, bool total);
+
+	// Records execution of one instruction on destruction
+	class Scope {
+		public:
+			// Genome is recorded before timing starts, so it doesn't count towards opcode's cost
+			Scope(OpClass cls_, uint64_t genomeHash, const Genome& genome):
+				cls(cls_), start((recordGenome(genomeHash, genome), now())) {};
+			Scope(const Scope&) = delete;
+			~Scope() {
+				record(cls, now() - start);
+			};
+		private:
+			OpClass cls;
+			uint64_t start;
+	};
+};
+
+#endif
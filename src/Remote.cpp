@@ -0,0 +1,227 @@
+#include "Remote.hpp"
+
+#ifdef WITH_REMOTE
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "World.hpp"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+[[noreturn]] static void ThrowErrno(const std::string& what) {
+	throw std::system_error(errno, std::generic_category(), what);
+}
+
+static void SetNonBlocking(int fd) {
+	int flags = fcntl(fd, F_GETFL);
+	if (flags < 0 or fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) ThrowErrno("Can't make socket non-blocking");
+}
+
+ControlServer::ControlServer(const std::string& path_): path(path_) {
+	sockaddr_un addr {};
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path)) throw std::runtime_error("Control socket path is too long: " + path);
+	std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+	listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenFd < 0) ThrowErrno("Can't create control socket");
+	try {
+		SetNonBlocking(listenFd);
+		unlink(path.c_str());
+		if (bind(listenFd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0) ThrowErrno("Can't bind control socket to " + path);
+		if (listen(listenFd, 8) < 0) ThrowErrno("Can't listen on control socket");
+	} catch (...) {
+		close(listenFd);
+		throw;
+	}
+}
+
+ControlServer::~ControlServer() {
+	for (auto& client : clients) {
+		close(client.fd);
+	}
+	close(listenFd);
+	unlink(path.c_str());
+}
+
+void ControlServer::poll(const Handler& handler, int timeoutMs) {
+	std::vector<pollfd> fds;
+	fds.reserve(clients.size() + 1);
+	fds.push_back({listenFd, POLLIN, 0});
+	for (const auto& client : clients) {
+		fds.push_back({client.fd, short(POLLIN | (client.out.empty() ? 0 : POLLOUT)), 0});
+	}
+	if (::poll(fds.data(), fds.size(), timeoutMs) <= 0) return;
+
+	// Clients are served before accepting new ones, so `fds` still matches them
+	std::vector<Client> alive;
+	alive.reserve(clients.size());
+	for (size_t i = 0; i < clients.size(); ++i) {
+		if (!fds[i + 1].revents or serve(clients[i], handler)) {
+			alive.push_back(std::move(clients[i]));
+		} else {
+			close(clients[i].fd);
+		}
+	}
+	clients = std::move(alive);
+
+	if (fds[0].revents & POLLIN) {
+		int fd;
+		while ((fd = accept(listenFd, nullptr, nullptr)) >= 0) {
+			SetNonBlocking(fd);
+			clients.push_back({fd, {}, {}});
+		}
+	}
+}
+
+bool ControlServer::serve(Client& client, const Handler& handler) {
+	// Misbehaving clients get disconnected rather than eat memory
+	constexpr size_t maxBuffered = 1 << 16;
+
+	bool closed = false;
+	char buf[4096];
+	while (true) {
+		auto n = read(client.fd, buf, sizeof(buf));
+		if (n > 0) {
+			client.in.append(buf, n);
+			if (client.in.size() > maxBuffered) return false;
+		} else if (n == 0) {
+			closed = true;
+			break;
+		} else if (errno == EINTR) {
+			continue;
+		} else if (errno == EAGAIN or errno == EWOULDBLOCK) {
+			break;
+		} else {
+			return false;
+		}
+	}
+
+	size_t eol;
+	while ((eol = client.in.find('\n')) != std::string::npos) {
+		std::string command = client.in.substr(0, eol);
+		client.in.erase(0, eol + 1);
+		if (!command.empty() and command.back() == '\r') command.pop_back();
+		client.out += handler(command);
+		client.out += '\n';
+	}
+
+	while (!client.out.empty()) {
+		auto n = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL);
+		if (n > 0) {
+			client.out.erase(0, n);
+		} else if (n < 0 and errno == EINTR) {
+			continue;
+		} else if (n < 0 and (errno == EAGAIN or errno == EWOULDBLOCK)) {
+			break;
+		} else {
+			return false;
+		}
+	}
+	return !closed and client.out.size() <= maxBuffered;
+}
+
+static size_t AlignUp(size_t val) {
+	constexpr size_t cacheLine = 64;
+	return (val + cacheLine - 1) / cacheLine * cacheLine;
+}
+
+SharedFeed::SharedFeed(const std::string& name_, size_t fieldW, size_t fieldH):
+	name((!name_.empty() and name_[0] == '/') ? name_ : "/" + name_),
+	slotSize(AlignUp(sizeof(FeedSlot) + size_t(frameMaxW) * frameMaxH * sizeof(uint32_t))),
+	fillView(pickSampleView(fieldW, fieldH)),
+	// ARGB8888
+	layout {16, 8, 0, 0xFF000000}
+{
+	size = AlignUp(sizeof(FeedHeader)) + slotCount * slotSize;
+
+	shm_unlink(name.c_str());
+	int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0) ThrowErrno("Can't create shared memory object " + name);
+	if (ftruncate(fd, size) < 0) {
+		int err = errno;
+		close(fd);
+		shm_unlink(name.c_str());
+		throw std::system_error(err, std::generic_category(), "Can't resize shared memory object " + name);
+	}
+	memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	int err = errno;
+	close(fd);
+	if (memory == MAP_FAILED) {
+		shm_unlink(name.c_str());
+		throw std::system_error(err, std::generic_category(), "Can't map shared memory object " + name);
+	}
+
+	auto hdr = new (memory) FeedHeader {};
+	std::memcpy(hdr->magic, "CSFEED\0\0", sizeof(hdr->magic));
+	hdr->version = 2;
+	hdr->slotCount = slotCount;
+	hdr->slotSize = slotSize;
+	hdr->fieldW = fieldW;
+	hdr->fieldH = fieldH;
+	hdr->frameMaxW = frameMaxW;
+	hdr->frameMaxH = frameMaxH;
+	for (size_t i = 0; i < slotCount; ++i) {
+		new (&slot(i)) FeedSlot {};
+	}
+	hdr->published.store(0, std::memory_order_release);
+
+	// Whole world, shrunk by powers of two until it fits. Never scaled up, frame is one pixel per sample.
+	Viewport viewport(fieldW, fieldH);
+	viewport.resize(frameMaxW, frameMaxH);
+	viewport.fit();
+	while (viewport.getZoom() > 0) {
+		viewport.zoomAt(-1, 0, 0);
+	}
+	view = viewport.visible();
+}
+
+SharedFeed::~SharedFeed() {
+	munmap(memory, size);
+	shm_unlink(name.c_str());
+}
+
+FeedSlot& SharedFeed::slot(size_t i) {
+	return *reinterpret_cast<FeedSlot*>(static_cast<char*>(memory) + AlignUp(sizeof(FeedHeader)) + i * slotSize);
+}
+
+void SharedFeed::publish(const World& world) {
+	auto& hdr = header();
+	auto published = hdr.published.load(std::memory_order_relaxed);
+	auto& s = slot(published % slotCount);
+
+	auto seq = s.seq.load(std::memory_order_relaxed);
+	s.seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	const auto& counters = world.getLastTick();
+	const auto& census = world.getCensus();
+	s.tick = world.getTickCount();
+	s.population = census.population();
+	s.totalEnergy = counters.totalEnergy;
+	s.totalPower = counters.totalPower;
+	s.strains = census.richness();
+	s.shannon = census.shannon();
+	s.frameW = view.w;
+	s.frameH = view.h;
+	s.blockShift = view.blockShift;
+	fillView(view, layout, reinterpret_cast<uint8_t*>(&s + 1), frameMaxW * sizeof(uint32_t));
+
+	s.seq.store(seq + 2, std::memory_order_release);
+	hdr.published.store(published + 1, std::memory_order_release);
+}
+
+#endif
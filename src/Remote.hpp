@@ -0,0 +1,113 @@
+#pragma once
+
+// Remote access for headless runs: text control socket and shared-memory feed of frames and statistics
+// POSIX only, compiled in when WITH_REMOTE is defined (see CMakeLists.txt)
+
+#ifdef WITH_REMOTE
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Render.hpp"
+
+class World;
+
+// Unix domain stream socket accepting line-based commands, one reply line per command
+// Never blocks simulation: everything is non-blocking and handled from poll()
+class ControlServer {
+	public:
+		// Throws if socket can't be created. Stale socket file at `path` is replaced.
+		explicit ControlServer(const std::string& path);
+		ControlServer(const ControlServer&) = delete;
+		ControlServer& operator=(const ControlServer&) = delete;
+		~ControlServer();
+
+		// Command line without newline in, reply line without newline out
+		using Handler = std::function<std::string(const std::string& command)>;
+		// Accept new clients and run their pending commands
+		// Waits up to `timeoutMs` for activity if there is nothing to do (0 doesn't wait at all)
+		void poll(const Handler& handler, int timeoutMs = 0);
+
+	private:
+		struct Client {
+			int fd;
+			std::string in;
+			std::string out;
+		};
+
+		std::string path;
+		int listenFd;
+		std::vector<Client> clients;
+
+		// Returns false if client is gone
+		bool serve(Client& client, const Handler& handler);
+};
+
+// Layout of shared memory feed, for use by external readers
+// Object is a header followed by `slotCount` slots of `slotSize` bytes each. Slot is FeedSlot followed by
+// frame of frameW x frameH pixels in ARGB8888 (native endian), with stride of `frameMaxW` pixels.
+// Slots are protected by sequence locks: writer makes `seq` odd while writing and even when done,
+// so reader must copy data out and retry if `seq` was odd or has changed meanwhile.
+struct FeedHeader {
+	char magic[8]; // "CSFEED\0\0"
+	uint32_t version;
+	uint32_t slotCount;
+	uint64_t slotSize;
+	uint32_t fieldW, fieldH;
+	uint32_t frameMaxW, frameMaxH;
+	// Amount of snapshots published so far. Latest one is in slot (published - 1) % slotCount.
+	std::atomic<uint64_t> published;
+};
+
+struct FeedSlot {
+	std::atomic<uint64_t> seq;
+	uint64_t tick;
+	uint64_t population;
+	// Of cells alive during last tick, after movement (see TickCounters)
+	uint64_t totalEnergy;
+	uint64_t totalPower;
+	uint64_t strains;
+	double shannon;
+	uint32_t frameW, frameH;
+	// Every pixel of frame is the middle slot of a block of 2^blockShift by 2^blockShift slots
+	uint32_t blockShift;
+	uint32_t reserved;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared memory feed needs address-free atomics");
+
+// Writer side of the feed. Readers only ever map it, so any amount of them costs simulation nothing.
+class SharedFeed {
+	public:
+		static constexpr uint32_t slotCount = 8;
+		static constexpr uint32_t frameMaxW = 512;
+		static constexpr uint32_t frameMaxH = 512;
+
+		// Creates POSIX shared memory object `name` (leading slash is optional), replacing existing one
+		SharedFeed(const std::string& name, size_t fieldW, size_t fieldH);
+		SharedFeed(const SharedFeed&) = delete;
+		SharedFeed& operator=(const SharedFeed&) = delete;
+		// Unlinks object, attached readers keep their mappings
+		~SharedFeed();
+
+		// Store snapshot of bound world into next slot. Must be called by thread that world is bound to.
+		// Only reads running counters and at most frameMaxW x frameMaxH slots, so cost doesn't grow with world.
+		void publish(const World& world);
+
+	private:
+		std::string name;
+		void* memory;
+		size_t size;
+		size_t slotSize;
+		FillViewFn fillView;
+		Viewport::Visible view;
+		PixelLayout layout;
+
+		FeedHeader& header() { return *static_cast<FeedHeader*>(memory); };
+		FeedSlot& slot(size_t i);
+};
+
+#endif
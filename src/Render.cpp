@@ -0,0 +1,255 @@
+#include "Render.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <SDL_pixels.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Global.hpp"
+
+Viewport::Viewport(size_t fieldW_, size_t fieldH_): fieldW(fieldW_), fieldH(fieldH_) {}
+
+void Viewport::resize(int windowW_, int windowH_) {
+	windowW = std::max(windowW_, 1);
+	windowH = std::max(windowH_, 1);
+	zoom = std::max(zoom, minZoom());
+	clamp();
+}
+
+int Viewport::minZoom() const {
+	// Whole world fits into a single pixel
+	int z = 0;
+	while ((size_t(1) << -z) < std::max(fieldW, fieldH)) --z;
+	return z;
+}
+
+double Viewport::slotsPerPixel() const {
+	return std::ldexp(1.0, -zoom);
+}
+
+void Viewport::fit() {
+	zoom = maxZoom;
+	while (zoom > minZoom() and (fieldW > windowW * slotsPerPixel() or fieldH > windowH * slotsPerPixel())) --zoom;
+	originX = 0;
+	originY = 0;
+	clamp();
+}
+
+void Viewport::zoomAt(int steps, int px, int py) {
+	double worldX = originX + px * slotsPerPixel();
+	double worldY = originY + py * slotsPerPixel();
+	zoom = std::clamp(zoom + steps, minZoom(), maxZoom);
+	originX = worldX - px * slotsPerPixel();
+	originY = worldY - py * slotsPerPixel();
+	clamp();
+}
+
+void Viewport::pan(int dx, int dy) {
+	originX -= dx * slotsPerPixel();
+	originY -= dy * slotsPerPixel();
+	clamp();
+}
+
+void Viewport::clamp() {
+	auto clampAxis = [](double& origin, double viewSlots, size_t fieldSize) {
+		if (viewSlots >= fieldSize) {
+			// Everything is visible, so center it
+			origin = (double(fieldSize) - viewSlots) / 2;
+		} else {
+			origin = std::clamp(origin, 0.0, fieldSize - viewSlots);
+		}
+	};
+	clampAxis(originX, windowW * slotsPerPixel(), fieldW);
+	clampAxis(originY, windowH * slotsPerPixel(), fieldH);
+}
+
+Viewport::Visible Viewport::visible() const {
+	Visible view;
+	view.blockShift = (zoom < 0) ? -zoom : 0;
+	view.pixelSize = (zoom > 0) ? (1 << zoom) : 1;
+	long block = long(1) << view.blockShift;
+
+	// Sample i covers [origin + i * block, origin + (i + 1) * block)
+	auto axis = [block, &view](double originF, int windowSize, size_t fieldSize, long& first, size_t& cnt, int& screen) {
+		long origin = std::floor(originF);
+		long samples = (windowSize + view.pixelSize - 1) / view.pixelSize;
+		long s0 = (origin >= 0) ? 0 : (-origin) / block;
+		long s1 = std::min(samples, (long(fieldSize) - origin + block - 1) / block);
+		first = origin + s0 * block;
+		cnt = (s1 > s0) ? s1 - s0 : 0;
+		screen = s0 * view.pixelSize;
+	};
+	axis(originX, windowW, fieldW, view.x0, view.w, view.screenX);
+	axis(originY, windowH, fieldH, view.y0, view.h, view.screenY);
+	return view;
+}
+
+std::optional<PixelLayout> pixelLayoutFor(uint32_t format) {
+	int bpp;
+	Uint32 r, g, b, a;
+	if (!SDL_PixelFormatEnumToMasks(format, &bpp, &r, &g, &b, &a) or bpp != 32) return std::nullopt;
+
+	auto shiftOf = [](Uint32 mask) -> std::optional<uint8_t> {
+		for (uint8_t shift = 0; shift <= 24; shift += 8) {
+			if (mask == (Uint32(0xFF) << shift)) return shift;
+		}
+		return std::nullopt;
+	};
+	auto red = shiftOf(r), green = shiftOf(g), blue = shiftOf(b);
+	if (!red or !green or !blue) return std::nullopt;
+	return PixelLayout {*red, *green, *blue, a};
+}
+
+static uint32_t ComposePixel(const PixelLayout& layout, uint8_t power, uint8_t energy, uint8_t light) {
+	// RED - power
+	// GREEN - energy
+	// BLUE - lighting level
+	return (uint32_t(std::min(power * 5, 255)) << layout.redShift)
+		| (uint32_t(energy) << layout.greenShift)
+		| (uint32_t(light) << layout.blueShift)
+		| layout.alpha;
+}
+
+#ifdef __SSE2__
+// Compose 16 consecutive slots of a column. out[i] gets rows 4i to 4i+3.
+static void ComposeColumn16(const PixelLayout& layout, size_t idx, __m128i maxLight, __m128i out[4]) {
+	auto power = _mm_loadu_si128((const __m128i*)(field.powerPlane + idx));
+	auto energy = _mm_loadu_si128((const __m128i*)(field.energyPlane + idx));
+	auto shadow = _mm_loadu_si128((const __m128i*)(field.shadowMap + idx));
+
+	// min(power * 5, 255) with saturating adds
+	auto power2 = _mm_adds_epu8(power, power);
+	auto red = _mm_adds_epu8(_mm_adds_epu8(power2, power2), power);
+	// max(maxLight - shadow, 0), same as GlobalFieldType::light()
+	auto blue = _mm_subs_epu8(maxLight, shadow);
+
+	const auto zero = _mm_setzero_si128();
+	for (size_t i = 0; i < 4; ++i) {
+		out[i] = _mm_set1_epi32(layout.alpha);
+	}
+	auto addChannel = [&zero, &out](__m128i val, uint8_t shift) {
+		const auto count = _mm_cvtsi32_si128(shift);
+		auto lo = _mm_unpacklo_epi8(val, zero);
+		auto hi = _mm_unpackhi_epi8(val, zero);
+		out[0] = _mm_or_si128(out[0], _mm_sll_epi32(_mm_unpacklo_epi16(lo, zero), count));
+		out[1] = _mm_or_si128(out[1], _mm_sll_epi32(_mm_unpackhi_epi16(lo, zero), count));
+		out[2] = _mm_or_si128(out[2], _mm_sll_epi32(_mm_unpacklo_epi16(hi, zero), count));
+		out[3] = _mm_or_si128(out[3], _mm_sll_epi32(_mm_unpackhi_epi16(hi, zero), count));
+	};
+	addChannel(red, layout.redShift);
+	addChannel(energy, layout.greenShift);
+	addChannel(blue, layout.blueShift);
+}
+#endif
+
+template<typename Geometry>
+static void FillView(const Viewport::Visible& view, const PixelLayout& layout, uint8_t* pixels, int pitch) {
+	auto row = [pixels, pitch](size_t y) { return reinterpret_cast<uint32_t*>(pixels + size_t(pitch) * y); };
+
+	if (view.blockShift == 0) {
+		// Slots are shown as is
+		// Planes are column-major while texture is row-major, so go in 16x4 tiles:
+		// compose columns of a tile, transpose them in registers and store full rows.
+		constexpr size_t tileH = 16;
+#ifdef WITH_OPENMP
+		#pragma omp taskloop shared(view, layout, row) default(none)
+#endif
+		for (size_t y = 0; y < view.h; y += tileH) {
+			size_t x = 0;
+#ifdef __SSE2__
+			if (y + tileH <= view.h) {
+				const auto maxLight = _mm_set1_epi8(*field.maxLight);
+				for (; x + 4 <= view.w; x += 4) {
+					__m128i cols[4][4];
+					for (size_t c = 0; c < 4; ++c) {
+						ComposeColumn16(layout, Point(view.y0 + y, view.x0 + x + c).toArrayIdx<Geometry>(), maxLight, cols[c]);
+					}
+					for (size_t g = 0; g < 4; ++g) {
+						auto t0 = _mm_unpacklo_epi32(cols[0][g], cols[1][g]);
+						auto t1 = _mm_unpacklo_epi32(cols[2][g], cols[3][g]);
+						auto t2 = _mm_unpackhi_epi32(cols[0][g], cols[1][g]);
+						auto t3 = _mm_unpackhi_epi32(cols[2][g], cols[3][g]);
+						_mm_storeu_si128((__m128i*)(row(y + g * 4 + 0) + x), _mm_unpacklo_epi64(t0, t1));
+						_mm_storeu_si128((__m128i*)(row(y + g * 4 + 1) + x), _mm_unpackhi_epi64(t0, t1));
+						_mm_storeu_si128((__m128i*)(row(y + g * 4 + 2) + x), _mm_unpacklo_epi64(t2, t3));
+						_mm_storeu_si128((__m128i*)(row(y + g * 4 + 3) + x), _mm_unpackhi_epi64(t2, t3));
+					}
+				}
+			}
+#endif
+			// Whatever is left of the tile
+			const size_t yEnd = std::min(y + tileH, view.h);
+			for (size_t ty = y; ty < yEnd; ++ty) {
+				auto out = row(ty);
+				for (size_t tx = x; tx < view.w; ++tx) {
+					auto idx = Point(view.y0 + ty, view.x0 + tx).toArrayIdx<Geometry>();
+					out[tx] = ComposePixel(layout, field.powerPlane[idx], field.energyPlane[idx], field.light(idx));
+				}
+			}
+		}
+	} else {
+		// Each sample is an aggregated block, clipped to the world
+		const long block = long(1) << view.blockShift;
+#ifdef WITH_OPENMP
+		#pragma omp taskloop shared(view, layout, row, block) default(none)
+#endif
+		for (size_t sy = 0; sy < view.h; ++sy) {
+			const long yBegin = std::max(view.y0 + long(sy) * block, 0l);
+			const long yEnd = std::min(view.y0 + long(sy + 1) * block, long(Geometry::height()));
+			auto out = row(sy);
+			for (size_t sx = 0; sx < view.w; ++sx) {
+				const long xBegin = std::max(view.x0 + long(sx) * block, 0l);
+				const long xEnd = std::min(view.x0 + long(sx + 1) * block, long(Geometry::width()));
+
+				uint8_t maxPower = 0, maxEnergy = 0;
+				size_t lightSum = 0;
+				for (long x = xBegin; x < xEnd; ++x) {
+					// Columns are contiguous in memory
+					for (long y = yBegin; y < yEnd; ++y) {
+						auto idx = Point(y, x).toArrayIdx<Geometry>();
+						maxPower = std::max(maxPower, field.powerPlane[idx]);
+						maxEnergy = std::max(maxEnergy, field.energyPlane[idx]);
+						lightSum += field.light(idx);
+					}
+				}
+
+				out[sx] = ComposePixel(layout, maxPower, maxEnergy, lightSum / ((xEnd - xBegin) * (yEnd - yBegin)));
+			}
+		}
+	}
+#ifdef WITH_OPENMP
+	#pragma omp taskwait
+#endif
+}
+
+template<typename Geometry>
+static void SampleView(const Viewport::Visible& view, const PixelLayout& layout, uint8_t* pixels, int pitch) {
+	if (view.blockShift == 0) return FillView<Geometry>(view, layout, pixels, pitch);
+
+	const long block = long(1) << view.blockShift;
+	for (size_t sy = 0; sy < view.h; ++sy) {
+		const long y = std::clamp(view.y0 + long(sy) * block + block / 2, 0l, long(Geometry::height()) - 1);
+		auto out = reinterpret_cast<uint32_t*>(pixels + size_t(pitch) * sy);
+		for (size_t sx = 0; sx < view.w; ++sx) {
+			const long x = std::clamp(view.x0 + long(sx) * block + block / 2, 0l, long(Geometry::width()) - 1);
+			auto idx = Point(y, x).toArrayIdx<Geometry>();
+			out[sx] = ComposePixel(layout, field.powerPlane[idx], field.energyPlane[idx], field.light(idx));
+		}
+	}
+}
+
+FillViewFn pickFillView(size_t fieldW, size_t fieldH) {
+	return dispatchGeometry(fieldW, fieldH, [](auto geometry) {
+		return &FillView<decltype(geometry)>;
+	});
+}
+
+FillViewFn pickSampleView(size_t fieldW, size_t fieldH) {
+	return dispatchGeometry(fieldW, fieldH, [](auto geometry) {
+		return &SampleView<decltype(geometry)>;
+	});
+}
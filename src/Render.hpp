@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+// Part of the world that is shown in the window and how it's scaled
+// Only visible samples are ever uploaded, so texture size depends on window rather than world size
+class Viewport {
+	public:
+		// Zoom is an exponent of two. Non-negative: every slot is 2^zoom pixels wide.
+		// Negative: every pixel shows aggregated block of 2^-zoom by 2^-zoom slots.
+		static constexpr int maxZoom = 5;
+
+		Viewport(size_t fieldW_, size_t fieldH_);
+
+		void resize(int windowW_, int windowH_);
+		// Show the whole world
+		void fit();
+		// Zoom in by `steps` (out if negative), keeping world point under window pixel (px, py) in place
+		void zoomAt(int steps, int px, int py);
+		// Move view by given amount of window pixels
+		void pan(int dx, int dy);
+
+		int getZoom() const { return zoom; };
+
+		struct Visible {
+			// World position of the first visible sample. Can be negative for blocks straddling world's edge.
+			long x0, y0;
+			// Amount of visible samples
+			size_t w, h;
+			// Window position of the first visible sample
+			int screenX, screenY;
+			// Samples are blocks of 2^blockShift slots
+			unsigned blockShift;
+			// And each takes this many pixels
+			int pixelSize;
+		};
+		Visible visible() const;
+	private:
+		size_t fieldW, fieldH;
+		int windowW = 1, windowH = 1;
+		int zoom = 0;
+		// World position of window's top left corner, in slots
+		double originX = 0, originY = 0;
+
+		int minZoom() const;
+		// Slots shown per window pixel
+		double slotsPerPixel() const;
+		void clamp();
+};
+
+// Where channels go in a 32-bit pixel
+struct PixelLayout {
+	uint8_t redShift;
+	uint8_t greenShift;
+	uint8_t blueShift;
+	uint32_t alpha;
+};
+
+// Layout of given SDL pixel format, if it's 32-bit with 8-bit channels
+std::optional<PixelLayout> pixelLayoutFor(uint32_t format);
+
+// Fills 32-bit `pixels` with visible samples of the bound world, reading packed planes rather than cells
+// RED - power, GREEN - energy, BLUE - lighting level. Blocks show max power and energy and mean light.
+using FillViewFn = void (*)(const Viewport::Visible& view, const PixelLayout& layout, uint8_t* pixels, int pitch);
+// Pick implementation specialized for world's geometry
+FillViewFn pickFillView(size_t fieldW, size_t fieldH);
+// Same, but blocks are point-sampled at their middle slot instead of aggregated, so cost depends on view size only
+FillViewFn pickSampleView(size_t fieldW, size_t fieldH);
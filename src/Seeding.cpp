@@ -0,0 +1,127 @@
+#include "Seeding.hpp"
+
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+template<size_t N>
+static bool ParseHex(const std::string& text, std::array<uint8_t, N>& out) {
+	if (text.size() != N * 2) return false;
+	auto digit = [](char c) -> int {
+		if (c >= '0' and c <= '9') return c - '0';
+		if (c >= 'a' and c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' and c <= 'F') return c - 'A' + 10;
+		return -1;
+	};
+	for (size_t i = 0; i < N; ++i) {
+		int hi = digit(text[i * 2]), lo = digit(text[i * 2 + 1]);
+		if (hi < 0 or lo < 0) return false;
+		out[i] = hi * 16 + lo;
+	}
+	return true;
+}
+
+template<size_t N>
+static void WriteHex(std::ostream& out, const std::array<uint8_t, N>& bytes) {
+	auto flags = out.flags();
+	out << std::hex << std::setfill('0');
+	for (auto byte : bytes) {
+		out << std::setw(2) << unsigned(byte);
+	}
+	out.flags(flags);
+	out << std::setfill(' ');
+}
+
+std::vector<GenomeBankEntry> readGenomeBank(std::istream& in) {
+	std::vector<GenomeBankEntry> entries;
+	std::string line;
+	size_t lineNum = 0;
+	while (std::getline(in, line)) {
+		++lineNum;
+		line = line.substr(0, line.find('#'));
+		std::istringstream stream {line};
+		std::string word;
+		if (!(stream >> word)) continue;
+
+		auto fail = [&lineNum, &word]() {
+			throw std::runtime_error("Invalid genome bank entry on line " + std::to_string(lineNum) + ": " + word);
+		};
+
+		GenomeBankEntry entry;
+		if (!ParseHex(word, entry.program)) fail();
+		while (stream >> word) {
+			if (word.rfind("energy=", 0) == 0) {
+				size_t pos;
+				unsigned long val;
+				try {
+					val = std::stoul(word.substr(7), &pos);
+				} catch (const std::exception&) {
+					fail();
+				}
+				if (pos != word.size() - 7 or val > 255) fail();
+				entry.energy = val;
+			} else if (word.rfind("regs=", 0) == 0) {
+				Cell::Registers regs;
+				if (!ParseHex(word.substr(5), regs)) fail();
+				entry.registers = regs;
+			} else {
+				fail();
+			}
+		}
+		entries.push_back(entry);
+	}
+	return entries;
+}
+
+void writeGenomeBank(std::ostream& out, const std::vector<GenomeBankEntry>& entries) {
+	for (const auto& entry : entries) {
+		WriteHex(out, entry.program);
+		if (entry.energy) out << " energy=" << unsigned(*entry.energy);
+		if (entry.registers) {
+			out << " regs=";
+			WriteHex(out, *entry.registers);
+		}
+		if (entry.count) out << " # " << entry.count << " cells";
+		out << '\n';
+	}
+}
+
+std::vector<uint8_t> readDensityMap(std::istream& in, size_t fieldW, size_t fieldH) {
+	// Header is magic, width, height and maximal value, separated by whitespace and possibly comments
+	auto readField = [&in]() {
+		while (true) {
+			in >> std::ws;
+			if (in.peek() != '#') break;
+			std::string comment;
+			std::getline(in, comment);
+		}
+		size_t val;
+		if (!(in >> val)) throw std::runtime_error("Malformed density map header");
+		return val;
+	};
+
+	std::string magic;
+	if (!(in >> magic) or magic != "P5") throw std::runtime_error("Density map must be a binary PGM (P5) image");
+	size_t imageW = readField();
+	size_t imageH = readField();
+	size_t maxVal = readField();
+	if (imageW == 0 or imageH == 0 or maxVal == 0 or maxVal > 255) {
+		throw std::runtime_error("Density map must be a non-empty 8-bit image");
+	}
+	// Single whitespace separates header from data
+	in.get();
+	std::vector<uint8_t> image(imageW * imageH);
+	if (!in.read(reinterpret_cast<char*>(image.data()), image.size())) throw std::runtime_error("Density map is truncated");
+
+	// Nearest neighbour, column by column
+	std::vector<uint8_t> weights(fieldW * fieldH);
+	for (size_t x = 0; x < fieldW; ++x) {
+		size_t imageX = x * imageW / fieldW;
+		for (size_t y = 0; y < fieldH; ++y) {
+			size_t imageY = y * imageH / fieldH;
+			weights[x * fieldH + y] = image[imageY * imageW + imageX] * 255 / maxVal;
+		}
+	}
+	return weights;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <vector>
+
+#include "Cell.hpp"
+
+// One program of a genome bank, with optional starting state
+struct GenomeBankEntry {
+	Cell::Program program {};
+	std::optional<uint8_t> energy;
+	std::optional<Cell::Registers> registers;
+	// Cells that had this program when exported, informational
+	size_t count = 0;
+};
+
+// Genome bank is a text file with one program per line:
+//   PROGRAM [energy=N] [regs=REGISTERS]
+// PROGRAM is 254 hex digits (127 bytes), REGISTERS is 26 hex digits (13 bytes, register 3 onwards).
+// Everything after '#' is a comment, empty lines are ignored.
+// Throws on malformed input.
+std::vector<GenomeBankEntry> readGenomeBank(std::istream& in);
+void writeGenomeBank(std::ostream& out, const std::vector<GenomeBankEntry>& entries);
+
+// Density map is a binary greyscale PGM ("P5") image stretched over the whole world.
+// Returns per-slot weights (0-255, white is 255), laid out like World's cellsField.
+std::vector<uint8_t> readDensityMap(std::istream& in, size_t fieldW, size_t fieldH);
+
+// What World::seedPopulation() places
+struct SeedSpec {
+	// Chance of every empty slot to get a cell
+	double density = 0.5;
+	// Scales density of every slot, uniform if empty (see readDensityMap())
+	std::vector<uint8_t> densityMap;
+	// Programs are picked from here with equal chances, or are entirely random if it's empty
+	std::vector<GenomeBankEntry> bank;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+
+// Little-endian binary IO for checkpoints and other files meant to be portable
+template<typename T>
+void writeLE(std::ostream& out, T val) {
+	static_assert(std::is_integral_v<T> or std::is_enum_v<T>);
+	char bytes[sizeof(T)];
+	for (size_t i = 0; i < sizeof(T); ++i) {
+		bytes[i] = char((uint64_t(val) >> (i * 8)) & 0xFF);
+	}
+	out.write(bytes, sizeof(T));
+}
+
+// Throws on end of file
+template<typename T>
+T readLE(std::istream& in) {
+	static_assert(std::is_integral_v<T> or std::is_enum_v<T>);
+	unsigned char bytes[sizeof(T)];
+	if (!in.read(reinterpret_cast<char*>(bytes), sizeof(T))) throw std::runtime_error("Unexpected end of file");
+	uint64_t val = 0;
+	for (size_t i = 0; i < sizeof(T); ++i) {
+		val |= uint64_t(bytes[i]) << (i * 8);
+	}
+	return T(val);
+}
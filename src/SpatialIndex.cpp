@@ -0,0 +1,181 @@
+#include "SpatialIndex.hpp"
+
+#include <algorithm>
+
+#include "Memory.hpp"
+
+SpatialIndex::SpatialIndex(size_t fieldW, size_t fieldH) {
+	size_t w = (fieldW + tileSide - 1) / tileSide;
+	size_t h = (fieldH + tileSide - 1) / tileSide;
+	while (true) {
+		Level level {w, h, std::make_unique<uint32_t[]>(w * h), std::make_unique<uint8_t[]>(w * h), std::make_unique<uint8_t[]>(w * h)};
+		levels.push_back(std::move(level));
+		if (w == 1 and h == 1) break;
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+	}
+	recounted = std::make_unique<Tile[]>(levels[0].w * levels[0].h);
+	dirty = std::make_unique<std::atomic<uint8_t>[]>(levels[0].w * levels[0].h);
+	for (size_t i = 0; i < levels[0].w * levels[0].h; ++i) {
+		dirty[i].store(1, std::memory_order_relaxed);
+	}
+}
+
+void SpatialIndex::beginRecount(size_t tx) {
+	const auto& leaf = levels[0];
+	for (size_t t = tx * leaf.h; t < (tx + 1) * leaf.h; ++t) {
+		recounted[t] = Tile {};
+		dirty[t].store(0, std::memory_order_relaxed);
+	}
+}
+
+template<typename Geometry>
+void SpatialIndex::update() {
+	auto& leaf = levels[0];
+	for (size_t tx = 0; tx < leaf.w; ++tx) {
+		for (size_t ty = 0; ty < leaf.h; ++ty) {
+			size_t t = tx * leaf.h + ty;
+			// Got or lost a cell after recount (births, deaths, anything between ticks), so count it anew
+			if (dirty[t].load(std::memory_order_relaxed)) {
+				dirty[t].store(0, std::memory_order_relaxed);
+				Tile tile;
+				size_t xEnd = std::min((tx + 1) << tileShift, Geometry::width());
+				size_t yEnd = std::min((ty + 1) << tileShift, Geometry::height());
+				for (size_t x = tx << tileShift; x < xEnd; ++x) {
+					for (size_t y = ty << tileShift; y < yEnd; ++y) {
+						auto idx = Point(y, x).toArrayIdx<Geometry>();
+						if (field.cellsField[idx]) {
+							++tile.count;
+							tile.maxEnergy = std::max(tile.maxEnergy, field.energyPlane[idx]);
+						}
+					}
+				}
+				recounted[t] = tile;
+			}
+			if (leaf.count[t] != recounted[t].count or leaf.maxEnergy[t] != recounted[t].maxEnergy) {
+				leaf.count[t] = recounted[t].count;
+				leaf.maxEnergy[t] = recounted[t].maxEnergy;
+				leaf.changed[t] = 1;
+			}
+		}
+	}
+
+	// Only tiles above changed ones are redone, and change goes further up only if it made a difference
+	for (size_t l = 1; l < levels.size(); ++l) {
+		auto& lower = levels[l - 1];
+		auto& level = levels[l];
+		for (size_t tx = 0; tx < lower.w; ++tx) {
+			for (size_t ty = 0; ty < lower.h; ++ty) {
+				if (!lower.changed[tx * lower.h + ty]) continue;
+				lower.changed[tx * lower.h + ty] = 0;
+				level.changed[(tx / 2) * level.h + ty / 2] = 1;
+			}
+		}
+		for (size_t tx = 0; tx < level.w; ++tx) {
+			for (size_t ty = 0; ty < level.h; ++ty) {
+				size_t t = tx * level.h + ty;
+				if (!level.changed[t]) continue;
+				uint32_t count = 0;
+				uint8_t maxEnergy = 0;
+				for (size_t cx = tx * 2; cx < std::min(tx * 2 + 2, lower.w); ++cx) {
+					for (size_t cy = ty * 2; cy < std::min(ty * 2 + 2, lower.h); ++cy) {
+						count += lower.count[cx * lower.h + cy];
+						maxEnergy = std::max(maxEnergy, lower.maxEnergy[cx * lower.h + cy]);
+					}
+				}
+				if (count == level.count[t] and maxEnergy == level.maxEnergy[t]) {
+					level.changed[t] = 0;
+				} else {
+					level.count[t] = count;
+					level.maxEnergy[t] = maxEnergy;
+				}
+			}
+		}
+	}
+	// There's nothing above the top
+	levels.back().changed[0] = 0;
+}
+
+template<typename Geometry>
+std::optional<Point> SpatialIndex::findNearest(const Point& pos, size_t radius, uint8_t minEnergy) const {
+	struct Node {
+		size_t dist;
+		size_t level;
+		size_t tx, ty;
+	};
+	auto fartherFirst = [](const Node& a, const Node& b) { return a.dist > b.dist; };
+	// Reused between queries so that they don't allocate
+	thread_local std::vector<Node> queue;
+	queue.clear();
+
+	// Tile is worth looking into if it might contain a suitable cell closer than best one so far
+	std::optional<Point> best;
+	size_t bestDist = radius;
+	size_t bestIdx = SIZE_MAX;
+	auto consider = [this, &pos, &bestDist, &fartherFirst, minEnergy](size_t l, size_t tx, size_t ty) {
+		const auto& level = levels[l];
+		auto t = tx * level.h + ty;
+		if (!level.count[t] or level.maxEnergy[t] < minEnergy) return;
+		// Chebyshev distance to closest slot of tile, tiles on the edge might extend past world but that's fine
+		size_t shift = tileShift + l;
+		size_t x0 = tx << shift, x1 = ((tx + 1) << shift) - 1;
+		size_t y0 = ty << shift, y1 = ((ty + 1) << shift) - 1;
+		size_t dx = (pos.x < x0) ? x0 - pos.x : ((pos.x > x1) ? pos.x - x1 : 0);
+		size_t dy = (pos.y < y0) ? y0 - pos.y : ((pos.y > y1) ? pos.y - y1 : 0);
+		size_t dist = std::max(dx, dy);
+		if (dist > bestDist) return;
+		queue.push_back({dist, l, tx, ty});
+		std::push_heap(queue.begin(), queue.end(), fartherFirst);
+	};
+
+	consider(levels.size() - 1, 0, 0);
+	while (!queue.empty()) {
+		std::pop_heap(queue.begin(), queue.end(), fartherFirst);
+		auto node = queue.back();
+		queue.pop_back();
+		// Everything left is at least this far
+		if (node.dist > bestDist) break;
+
+		if (node.level > 0) {
+			const auto& lower = levels[node.level - 1];
+			for (size_t cx = node.tx * 2; cx < std::min(node.tx * 2 + 2, lower.w); ++cx) {
+				for (size_t cy = node.ty * 2; cy < std::min(node.ty * 2 + 2, lower.h); ++cy) {
+					consider(node.level - 1, cx, cy);
+				}
+			}
+			continue;
+		}
+
+		size_t xEnd = std::min((node.tx + 1) << tileShift, Geometry::width());
+		size_t yEnd = std::min((node.ty + 1) << tileShift, Geometry::height());
+		for (size_t x = node.tx << tileShift; x < xEnd; ++x) {
+			for (size_t y = node.ty << tileShift; y < yEnd; ++y) {
+				if (x == pos.x and y == pos.y) continue;
+				auto idx = Point(y, x).toArrayIdx<Geometry>();
+				if (!field.cellsField[idx] or field.energyPlane[idx] < minEnergy) continue;
+				size_t dist = std::max((x > pos.x) ? x - pos.x : pos.x - x, (y > pos.y) ? y - pos.y : pos.y - y);
+				if (dist < bestDist or (dist == bestDist and idx < bestIdx)) {
+					bestDist = dist;
+					bestIdx = idx;
+					best = Point(y, x);
+				}
+			}
+		}
+	}
+	return best;
+}
+
+size_t SpatialIndex::memoryUsage() const {
+	size_t leaves = levels[0].w * levels[0].h;
+	size_t bytes = heapBlockBytes(levels.capacity() * sizeof(Level)) + heapBlockBytes(leaves * sizeof(Tile)) + heapBlockBytes(leaves);
+	for (const auto& level : levels) {
+		bytes += heapBlockBytes(level.w * level.h * sizeof(uint32_t)) + 2 * heapBlockBytes(level.w * level.h);
+	}
+	return bytes;
+}
+
+#define INSTANTIATE_FOR_GEOMETRY(...) \
+	template void SpatialIndex::update<__VA_ARGS__>(); \
+	template std::optional<Point> SpatialIndex::findNearest<__VA_ARGS__>(const Point& pos, size_t radius, uint8_t minEnergy) const;
+INSTANTIATE_FOR_EACH_GEOMETRY
+#undef INSTANTIATE_FOR_GEOMETRY
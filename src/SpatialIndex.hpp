@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "Global.hpp"
+
+// Pyramid of occupancy and maximal energy over square tiles, used by FIND and FINDE opcodes
+// Level 0 tiles are tileSide x tileSide slots, every next level merges 2 x 2 tiles of previous one, up to a single tile.
+// Queries walk it best-first, so empty parts of the world are skipped a whole tile at a time.
+// Level 0 is recounted by World's end-of-tick sweep, which visits every slot anyway. Tiles that change after that
+// are marked dirty and rescanned by update(), which then only redoes upper level tiles above changed ones.
+class SpatialIndex {
+	public:
+		static constexpr size_t tileShift = 3;
+		static constexpr size_t tileSide = size_t(1) << tileShift;
+
+		SpatialIndex(size_t fieldW, size_t fieldH);
+
+		// Must be called whenever a slot gets or loses a cell, safe to call from multiple threads
+		void markDirty(const Point& pos) {
+			dirty[leafIdx(pos)].store(1, std::memory_order_relaxed);
+		};
+
+		// Recount of level 0: every tile column must be recounted by a single thread, starting with beginRecount()
+		// and followed by recount() for every cell in it. Marks on recounted tiles are dropped, since counts are exact.
+		void beginRecount(size_t tx);
+		void recount(const Point& pos, uint8_t energy) {
+			auto t = leafIdx(pos);
+			++recounted[t].count;
+			recounted[t].maxEnergy = std::max(recounted[t].maxEnergy, energy);
+		};
+
+		// Bring index up to date with cellsField and energyPlane of bound world
+		// Must not run concurrently with queries or changes to the world.
+		template<typename Geometry>
+		void update();
+
+		// Nearest cell to `pos` (not counting one at `pos` itself) within Chebyshev distance `radius`
+		// whose energy is at least `minEnergy`. Equally close cells are told apart by slot index, lower one wins.
+		// Reads bound world, safe to call concurrently as long as nothing is modified.
+		template<typename Geometry>
+		std::optional<Point> findNearest(const Point& pos, size_t radius, uint8_t minEnergy) const;
+
+		// Estimated heap usage, in bytes
+		size_t memoryUsage() const;
+
+	private:
+		struct Tile {
+			uint32_t count = 0;
+			uint8_t maxEnergy = 0;
+		};
+		struct Level {
+			size_t w, h;
+			// Column-major like cellsField
+			std::unique_ptr<uint32_t[]> count;
+			std::unique_ptr<uint8_t[]> maxEnergy;
+			// Set for tiles that changed since level above was last redone
+			std::unique_ptr<uint8_t[]> changed;
+		};
+		std::vector<Level> levels;
+		// Level 0 as of last recount, one per level 0 tile like the rest
+		std::unique_ptr<Tile[]> recounted;
+		std::unique_ptr<std::atomic<uint8_t>[]> dirty;
+
+		size_t leafIdx(const Point& pos) const {
+			return (pos.x >> tileShift) * levels[0].h + (pos.y >> tileShift);
+		};
+};
@@ -0,0 +1,147 @@
+#include "Telemetry.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+#include "Memory.hpp"
+
+const char* Telemetry::metricName(Metric metric) {
+	switch (metric) {
+	case POPULATION: return "population";
+	case ENERGY: return "energy";
+	case POWER: return "power";
+	case BIRTHS: return "births";
+	case DEATHS: return "deaths";
+	case EATS: return "eats";
+	case MOVES: return "moves";
+	case TICKS_PER_SECOND: return "ticks_per_second";
+	case METRIC_COUNT: break;
+	}
+	return "unknown";
+}
+
+Telemetry::Telemetry(size_t capacity, size_t factor_, size_t levelCount): factor(factor_) {
+	if (capacity == 0 or factor < 2 or levelCount == 0) throw std::invalid_argument("Invalid telemetry store size");
+	levels.resize(levelCount);
+	for (auto& level : levels) {
+		level.ring.resize(capacity);
+	}
+}
+
+void Telemetry::Bucket::merge(const Bucket& other) {
+	lastTick = other.lastTick;
+	ticks += other.ticks;
+	for (size_t i = 0; i < METRIC_COUNT; ++i) {
+		min[i] = std::min(min[i], other.min[i]);
+		max[i] = std::max(max[i], other.max[i]);
+		sum[i] += other.sum[i];
+	}
+}
+
+void Telemetry::record(size_t tick, const Sample& sample) {
+	auto now = std::chrono::steady_clock::now();
+	Bucket bucket {tick, tick, 1, sample, sample, sample};
+	double rate = 0;
+	if (lastRecord) {
+		double seconds = std::chrono::duration<double>(now - *lastRecord).count();
+		if (seconds > 0) rate = 1 / seconds;
+	}
+	lastRecord = now;
+	bucket.min[TICKS_PER_SECOND] = bucket.max[TICKS_PER_SECOND] = bucket.sum[TICKS_PER_SECOND] = rate;
+	push(0, bucket);
+}
+
+void Telemetry::push(size_t l, const Bucket& bucket) {
+	auto& level = levels[l];
+	level.ring[level.next] = bucket;
+	level.next = (level.next + 1) % level.ring.size();
+	level.filled = std::min(level.filled + 1, level.ring.size());
+
+	if (l + 1 == levels.size()) return;
+	auto& upper = levels[l + 1];
+	if (upper.pendingParts == 0) upper.pending = bucket;
+	else upper.pending.merge(bucket);
+	if (++upper.pendingParts == factor) {
+		upper.pendingParts = 0;
+		push(l + 1, upper.pending);
+	}
+}
+
+template<typename Fn>
+void Telemetry::forEachBucket(Fn&& fn) const {
+	for (size_t l = levels.size(); l-- > 0;) {
+		const auto& level = levels[l];
+		size_t first = (level.next + level.ring.size() - level.filled) % level.ring.size();
+		for (size_t i = 0; i < level.filled; ++i) {
+			fn(l, level.ring[(first + i) % level.ring.size()]);
+		}
+	}
+}
+
+void Telemetry::writeCsv(std::ostream& out) const {
+	// Default of 6 significant digits loses counters past a million and most of mean's fraction
+	auto precision = out.precision(std::numeric_limits<double>::max_digits10);
+	out << "level,first_tick,last_tick";
+	for (size_t i = 0; i < METRIC_COUNT; ++i) {
+		auto name = metricName(Metric(i));
+		out << ',' << name << "_min," << name << "_mean," << name << "_max";
+	}
+	out << '\n';
+	forEachBucket([&out](size_t l, const Bucket& bucket) {
+		out << l << ',' << bucket.firstTick << ',' << bucket.lastTick;
+		for (size_t i = 0; i < METRIC_COUNT; ++i) {
+			out << ',' << bucket.min[i] << ',' << bucket.sum[i] / bucket.ticks << ',' << bucket.max[i];
+		}
+		out << '\n';
+	});
+	out.precision(precision);
+}
+
+void Telemetry::writeJson(std::ostream& out) const {
+	auto precision = out.precision(std::numeric_limits<double>::max_digits10);
+	out << "{\"metrics\":[";
+	for (size_t i = 0; i < METRIC_COUNT; ++i) {
+		out << (i ? "," : "") << '"' << metricName(Metric(i)) << '"';
+	}
+	out << "],\"levels\":[";
+	size_t currentLevel = SIZE_MAX;
+	forEachBucket([&out, &currentLevel, this](size_t l, const Bucket& bucket) {
+		if (l != currentLevel) {
+			if (currentLevel != SIZE_MAX) out << "]},";
+			// Span of level 0 bucket is a single tick
+			size_t span = 1;
+			for (size_t i = 0; i < l; ++i) span *= factor;
+			out << "{\"level\":" << l << ",\"ticksPerBucket\":" << span << ",\"buckets\":[";
+			currentLevel = l;
+		} else {
+			out << ',';
+		}
+		auto array = [&out](const Sample& values, double div) {
+			out << '[';
+			for (size_t i = 0; i < METRIC_COUNT; ++i) {
+				out << (i ? "," : "") << values[i] / div;
+			}
+			out << ']';
+		};
+		out << "{\"first\":" << bucket.firstTick << ",\"last\":" << bucket.lastTick << ",\"min\":";
+		array(bucket.min, 1);
+		out << ",\"mean\":";
+		array(bucket.sum, bucket.ticks);
+		out << ",\"max\":";
+		array(bucket.max, 1);
+		out << '}';
+	});
+	if (currentLevel != SIZE_MAX) out << "]}";
+	out << "]}\n";
+	out.precision(precision);
+}
+
+size_t Telemetry::memoryUsage() const {
+	size_t bytes = containerBytes(levels);
+	for (const auto& level : levels) {
+		bytes += containerBytes(level.ring);
+	}
+	return bytes;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <ostream>
+#include <vector>
+
+// Fixed-size history of per-tick statistics, in the spirit of RRDtool
+// Level 0 keeps last `capacity` ticks as they were. Every next level keeps as many buckets, each consolidating
+// `factor` buckets of previous level into min, mean and max, so it reaches `factor` times further back.
+// Recording a tick is a handful of additions and never allocates. Not thread-safe.
+class Telemetry {
+	public:
+		enum Metric {
+			POPULATION,
+			ENERGY,
+			POWER,
+			BIRTHS,
+			DEATHS,
+			EATS,
+			MOVES,
+			// Measured by the store itself from wall time between records
+			TICKS_PER_SECOND,
+			METRIC_COUNT
+		};
+		static const char* metricName(Metric metric);
+		using Sample = std::array<double, METRIC_COUNT>;
+
+		// Throws if any of parameters is 0 (or 1 for `factor`)
+		explicit Telemetry(size_t capacity = 1024, size_t factor = 16, size_t levels = 5);
+
+		// TICKS_PER_SECOND of `sample` is ignored
+		void record(size_t tick, const Sample& sample);
+
+		// One row per bucket: level, first and last tick, then min, mean and max of every metric.
+		// Coarsest level goes first, buckets are oldest first within a level.
+		void writeCsv(std::ostream& out) const;
+		// Same data as an object with metric names and array of levels
+		void writeJson(std::ostream& out) const;
+
+		// Estimated heap usage, in bytes. It doesn't change after construction.
+		size_t memoryUsage() const;
+
+	private:
+		struct Bucket {
+			size_t firstTick;
+			size_t lastTick;
+			size_t ticks;
+			Sample min;
+			Sample max;
+			Sample sum;
+
+			void merge(const Bucket& other);
+		};
+		struct Level {
+			std::vector<Bucket> ring;
+			// Where next bucket goes and amount of buckets stored so far
+			size_t next = 0;
+			size_t filled = 0;
+			// Buckets of previous level merged so far into the one being built
+			Bucket pending;
+			size_t pendingParts = 0;
+		};
+		size_t factor;
+		std::vector<Level> levels;
+		std::optional<std::chrono::steady_clock::time_point> lastRecord;
+
+		void push(size_t level, const Bucket& bucket);
+		// Calls fn(level, bucket) in order of export
+		template<typename Fn>
+		void forEachBucket(Fn&& fn) const;
+};
@@ -0,0 +1,43 @@
+#include "Verify.hpp"
+
+#include <chrono>
+
+VerifyResult runVerification(const VerifySpec& spec) {
+	VerifyResult result;
+	World reference(spec.fieldW, spec.fieldH, spec.seed);
+	World candidate(spec.fieldW, spec.fieldH, spec.seed);
+	reference.useGenericKernels();
+	reference.fastForward = false;
+	candidate.fastForward = spec.fastForward;
+
+	SeedSpec seeding;
+	seeding.density = spec.density;
+	reference.bind();
+	reference.seedPopulation(seeding);
+	candidate.bind();
+	candidate.seedPopulation(seeding);
+	if ((result.divergence = reference.compareState(candidate))) {
+		*result.divergence = "Before first tick: " + *result.divergence;
+		return result;
+	}
+
+	// Only time tick() itself, world comparison takes much longer than that
+	auto timedTick = [](World& world, double& seconds) {
+		world.bind();
+		auto start = std::chrono::steady_clock::now();
+		world.tick();
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	for (size_t i = 0; i < spec.ticks; ++i) {
+		result.cellTicks += reference.getCensus().population();
+		timedTick(reference, result.referenceSeconds);
+		timedTick(candidate, result.candidateSeconds);
+		if ((result.divergence = reference.compareState(candidate))) {
+			*result.divergence = "Tick " + std::to_string(reference.getTickCount()) + ": " + *result.divergence;
+			return result;
+		}
+		++result.ticksMatched;
+	}
+	return result;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include "World.hpp"
+
+// Differential check of world's fast paths against reference implementation
+// Two worlds are made from the same seed and densely seeded with random programs, then stepped side by side
+// with full state compared after every tick. Reference one uses kernels for arbitrary field size and never fast-forwards,
+// while candidate gets ones specialized for it when there are any. Doubles as throughput comparison.
+struct VerifySpec {
+	size_t fieldW;
+	size_t fieldH;
+	size_t ticks;
+	uint_fast32_t seed;
+	// Whether candidate fast-forwards closed loops, reference never does
+	bool fastForward = true;
+	// Share of slots that get a random program at start
+	double density = 0.3;
+};
+
+struct VerifyResult {
+	// Description of first divergence, nothing if worlds stayed identical
+	std::optional<std::string> divergence;
+	// Ticks that were identical in both worlds
+	size_t ticksMatched = 0;
+	// Sum of population over all ticks run
+	size_t cellTicks = 0;
+	double referenceSeconds = 0;
+	double candidateSeconds = 0;
+};
+
+VerifyResult runVerification(const VerifySpec& spec);
@@ -0,0 +1,848 @@
+#include "World.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+
+#include "Memory.hpp"
+#include "Serialize.hpp"
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+thread_local GlobalSettingsType global;
+thread_local GlobalFieldType field;
+
+// Stateless per-slot shadow noise, either 0 or 1
+static uint8_t shadowNoise(size_t x, size_t y, size_t epoch) {
+	// splitmix64 finalizer
+	uint64_t z = (uint64_t(x) << 40) ^ (uint64_t(y) << 16) ^ epoch;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	z = z ^ (z >> 31);
+	return z & 1;
+}
+
+World::World(size_t fieldW, size_t fieldH, uint_fast32_t seed): spatialIndex(fieldW, fieldH) {
+	settings.fieldW = fieldW;
+	settings.fieldH = fieldH;
+
+	shadowMap = std::make_unique<uint8_t[]> (fieldH * fieldW);
+	energyPlane = std::make_unique<uint8_t[]> (fieldH * fieldW);
+	powerPlane = std::make_unique<uint8_t[]> (fieldH * fieldW);
+	parkedPlane = std::make_unique<uint8_t[]> (fieldH * fieldW);
+	dirtyColumns = std::make_unique<uint8_t[]> (fieldW);
+	std::fill_n(dirtyColumns.get(), fieldW, 1);
+	cellsField = std::make_unique<Cell*[]>(fieldH * fieldW);
+	birthClaims = std::make_unique<std::atomic<uint32_t>[]>(fieldH * fieldW);
+	for (size_t i = 0; i < fieldH * fieldW; ++i) {
+		birthClaims[i].store(noClaim, std::memory_order_relaxed);
+	}
+
+	// Setup random number generators, one per thread
+#ifdef WITH_OPENMP
+	size_t threads = omp_get_max_threads();
+#else
+	size_t threads = 1;
+#endif
+	rngs = std::make_unique<randomGenerator[]>(threads);
+
+	tickFn = dispatchGeometry(fieldW, fieldH, [](auto geometry) {
+		return &World::tickImpl<decltype(geometry)>;
+	});
+	std::seed_seq seq {seed};
+	std::vector<uint_fast32_t> seeds(threads);
+	seq.generate(seeds.begin(), seeds.end());
+	for (size_t i = 0; i < threads; ++i) {
+		rngs[i].seed(seeds[i]);
+	}
+}
+
+void World::bind() {
+	global = settings;
+	field.cellsField = cellsField.get();
+	field.energyPlane = energyPlane.get();
+	field.powerPlane = powerPlane.get();
+	field.shadowMap = shadowMap.get();
+	field.maxLight = &maxLight;
+	field.index = &spatialIndex;
+}
+
+randomGenerator& World::threadRng() {
+#ifdef WITH_OPENMP
+	return rngs[omp_get_thread_num()];
+#else
+	return rngs[0];
+#endif
+}
+
+void World::spawnRandomCells(size_t cnt) {
+	auto& rng = threadRng();
+	std::uniform_int_distribution<size_t> wDist(0, settings.fieldW - 1);
+	std::uniform_int_distribution<size_t> hDist(0, settings.fieldH - 1);
+	auto limit = populationLimit();
+	for (size_t i = 0; i < cnt and cellsMap.size() < limit; ++i) {
+		auto pos = Point(hDist(rng), wDist(rng));
+		if (cellsField[pos.toArrayIdx()]) continue;
+		auto newCell = std::make_unique<Cell>(nextCellId++);
+		census.add(newCell->getGenomeHash(), tickCount);
+		if (lineage) lineage->birth(tickCount, newCell->getId(), 0, pos, 0);
+		setFieldCell(pos, newCell.get());
+		cellsMap.emplace(pos, std::move(newCell));
+	}
+}
+
+size_t World::seedPopulation(const SeedSpec& spec) {
+	// Every column gets its own stream derived from one seed, so placement doesn't depend on amount of threads
+	// Drawn in separate statements, order of evaluation of operands is unspecified
+	auto& rng = threadRng();
+	const uint64_t seedHi = rng();
+	const uint64_t seedLo = rng();
+	const uint64_t seed = (seedHi << 32) ^ seedLo;
+	// Slot IDs are spread over a fresh range, gaps don't matter
+	const uint64_t baseId = nextCellId;
+	nextCellId += settings.fieldW * settings.fieldH;
+	// Slot gets a cell if 32-bit random value is below its threshold
+	const uint64_t threshold = std::clamp(spec.density, 0.0, 1.0) * 4294967296.0;
+
+	std::vector<std::vector<std::pair<Point, std::unique_ptr<Cell>>>> columns(settings.fieldW);
+#ifdef WITH_OPENMP
+	#pragma omp parallel firstprivate(seed, baseId, threshold) shared(spec, columns)
+#endif
+	{
+		bind();
+#ifdef WITH_OPENMP
+		#pragma omp for schedule(dynamic, 16)
+#endif
+		for (size_t x = 0; x < global.fieldW; ++x) {
+			// splitmix64, started at a scrambled point so that neighbouring columns' streams don't overlap
+			auto mix = [](uint64_t z) {
+				z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+				z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+				return z ^ (z >> 31);
+			};
+			uint64_t state = mix(seed ^ mix(x + 1));
+			auto next = [&state, &mix]() {
+				return mix(state += 0x9E3779B97F4A7C15ull);
+			};
+
+			for (size_t y = 0; y < global.fieldH; ++y) {
+				Point pos(y, x);
+				auto idx = pos.toArrayIdx();
+				auto limit = spec.densityMap.empty() ? threshold : threshold * spec.densityMap[idx] / 255;
+				if ((next() >> 32) >= limit or cellsField[idx]) continue;
+
+				std::unique_ptr<Cell> cell;
+				if (spec.bank.empty()) {
+					Cell::Program program;
+					for (size_t i = 0; i < program.size(); i += 8) {
+						auto bits = next();
+						for (size_t j = i; j < std::min(i + 8, program.size()); ++j, bits >>= 8) {
+							program[j] = bits & 0xFF;
+						}
+					}
+					cell = std::make_unique<Cell>(baseId + idx, program, std::nullopt, std::nullopt);
+				} else {
+					const auto& entry = spec.bank[next() % spec.bank.size()];
+					cell = std::make_unique<Cell>(baseId + idx, entry.program, entry.energy, entry.registers);
+				}
+				// Columns are private to their thread, so that's safe
+				setFieldCell(pos, cell.get());
+				columns[x].emplace_back(pos, std::move(cell));
+			}
+		}
+	}
+	bind();
+
+	size_t generated = 0;
+	for (const auto& column : columns) {
+		generated += column.size();
+	}
+	// Over the limit, keep an evenly spaced subset instead of cutting off the last columns
+	auto limit = populationLimit();
+	size_t placed = std::min(generated, (limit > cellsMap.size()) ? limit - cellsMap.size() : 0);
+	cellsMap.reserve(cellsMap.size() + placed);
+	size_t seen = 0;
+	for (auto& column : columns) {
+		for (auto& pair : column) {
+			size_t idx = seen++;
+			if ((idx + 1) * placed / generated == idx * placed / generated) {
+				setFieldCell(pair.first, nullptr);
+				continue;
+			}
+			census.add(pair.second->getGenomeHash(), tickCount);
+			if (lineage) lineage->birth(tickCount, pair.second->getId(), 0, pair.first, 0);
+			cellsMap.emplace(pair.first, std::move(pair.second));
+		}
+	}
+	return placed;
+}
+
+std::vector<GenomeBankEntry> World::exportGenomes(size_t limit) const {
+	auto strains = census.top(limit);
+	std::vector<GenomeBankEntry> entries(strains.size());
+	std::unordered_map<uint64_t, size_t> missing;
+	for (size_t i = 0; i < strains.size(); ++i) {
+		entries[i].count = strains[i].count;
+		missing.emplace(strains[i].genome, i);
+	}
+	for (auto it = cellsMap.begin(); it != cellsMap.end() and !missing.empty(); ++it) {
+		const auto& cell = *it->second;
+		auto strain = missing.find(cell.getGenomeHash());
+		if (strain == missing.end()) continue;
+		auto& entry = entries[strain->second];
+		entry.program = cell.getProgram();
+		entry.energy = cell.getEnergy();
+		entry.registers = cell.getRegisters();
+		missing.erase(strain);
+	}
+	return entries;
+}
+
+void World::tick() {
+	(this->*tickFn)();
+}
+
+void World::useGenericKernels() {
+	tickFn = &World::tickImpl<DynamicGeometry>;
+}
+
+WorldStats World::collectStats() const {
+	WorldStats stats;
+	stats.population = cellsMap.size();
+	for (const auto& pair : cellsMap) {
+		stats.totalEnergy += pair.second->getEnergy();
+		stats.totalPower += pair.second->getPower();
+	}
+	return stats;
+}
+
+// Upper estimate of what one more cell costs: the object, its map node, buckets (table doubles as it grows),
+// census node (hash, count and first tick) if it starts a new strain and its entries in per-tick vectors
+static constexpr size_t bytesPerCell = heapBlockBytes(sizeof(Cell)) + hashNodeBytes<Point, std::unique_ptr<Cell>>()
+	+ 2 * sizeof(void*) + heapBlockBytes(sizeof(void*) + 4 * sizeof(uint64_t)) + 3 * sizeof(std::pair<Point, Cell*>);
+
+MemoryUsage World::memoryUsage() const {
+	MemoryUsage usage;
+	size_t population = cellsMap.size();
+	usage.cells = population * (heapBlockBytes(sizeof(Cell)) - sizeof(Cell::Program));
+	usage.genomes = population * sizeof(Cell::Program) + census.memoryUsage();
+	usage.index = containerBytes(cellsMap);
+
+	size_t slots = settings.fieldW * settings.fieldH;
+	usage.grids = heapBlockBytes(slots * sizeof(Cell*)) + 4 * heapBlockBytes(slots) + heapBlockBytes(settings.fieldW)
+		+ heapBlockBytes(slots * sizeof(std::atomic<uint32_t>)) + spatialIndex.memoryUsage();
+
+	usage.buffers = containerBytes(moves) + containerBytes(energyts) + containerBytes(eats)
+		+ containerBytes(divisions) + containerBytes(todie) + containerBytes(births);
+	return usage;
+}
+
+size_t World::populationLimit() const {
+	size_t limit = populationCap ? populationCap : SIZE_MAX;
+	if (memoryCap) {
+		auto used = memoryUsage().total();
+		size_t room = (used < memoryCap) ? (memoryCap - used) / bytesPerCell : 0;
+		limit = std::min(limit, cellsMap.size() + room);
+	}
+	return limit;
+}
+
+bool World::admitBirth(size_t limit, randomGenerator& rng) {
+	size_t population = cellsMap.size();
+	if (population >= limit) return false;
+	// In the last eighth before limit chance of birth falls linearly to zero, so that population
+	// settles below the ceiling instead of hitting it every tick. Uncapped runs never get here.
+	size_t soft = limit - limit / 8;
+	if (population < soft) return true;
+	std::uniform_int_distribution<size_t> dist(soft, limit - 1);
+	return dist(rng) >= population;
+}
+
+template<typename Geometry>
+std::optional<Point> World::pickBirthSlot(const Point& pos, randomGenerator& rng, bool unclaimedOnly) const {
+	std::array<uint8_t, DirectionMax> possibleDirs;
+	size_t possibleCnt = 0;
+	for (uint8_t dir = 0; dir < DirectionMax; ++dir) {
+		// If it's a valid cell
+		if (std::optional<Point> npos = pos.applyNew<Geometry>(Direction(dir))) {
+			// and it's empty
+			auto idx = npos->toArrayIdx<Geometry>();
+			if (!cellsField[idx] and (!unclaimedOnly or birthClaims[idx].load(std::memory_order_relaxed) == noClaim)) {
+				possibleDirs[possibleCnt++] = dir;
+			}
+		}
+	}
+	if (possibleCnt == 0) return std::nullopt;
+	std::uniform_int_distribution<uint8_t> dist(0, possibleCnt - 1);
+	Point slot = *pos.applyNew<Geometry>(Direction(possibleDirs[dist(rng)]));
+	slot.checkBounds<Geometry>();
+	return slot;
+}
+
+template<typename Geometry>
+void World::planBirth(size_t i, uint64_t seed, uint64_t childId) {
+	const Point& pos = divisions[i];
+	auto parent = cellsField[pos.toArrayIdx<Geometry>()];
+	auto& birth = births[i];
+
+	// splitmix64 finalizer, so that close IDs give unrelated streams
+	uint64_t z = seed ^ parent->getId();
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	birth.rng.seed(z ^ (z >> 31));
+
+	birth.target = pickBirthSlot<Geometry>(pos, birth.rng, false);
+	if (!birth.target) return;
+	auto& claim = birthClaims[birth.target->toArrayIdx<Geometry>()];
+	// Lowest index wins, no matter in which order claims come
+	uint32_t current = claim.load(std::memory_order_relaxed);
+	while (i < current and !claim.compare_exchange_weak(current, i, std::memory_order_relaxed)) {}
+
+	// Child doesn't depend on where it goes, so it's made even if claim is lost
+	std::uniform_int_distribution<size_t> mutDist(0, mutationRate);
+	birth.child = parent->fork(childId);
+	birth.mutations = birth.child->mutate(mutDist(birth.rng), birth.rng);
+}
+
+std::optional<std::string> World::compareState(const World& other) const {
+	auto pair = [](const char* name, size_t a, size_t b) {
+		return std::string(name) + " " + std::to_string(a) + " vs " + std::to_string(b);
+	};
+	if (tickCount != other.tickCount) return pair("tick", tickCount, other.tickCount);
+	if (nextCellId != other.nextCellId) return pair("next cell ID", nextCellId, other.nextCellId);
+	if (cellsMap.size() != other.cellsMap.size()) return pair("population", cellsMap.size(), other.cellsMap.size());
+	if (census.richness() != other.census.richness()) return pair("strains", census.richness(), other.census.richness());
+	if (throttledBirths != other.throttledBirths) return pair("throttled births", throttledBirths, other.throttledBirths);
+	if (maxLight != other.maxLight) return pair("light", maxLight, other.maxLight);
+#ifdef WITH_OPENMP
+	size_t threads = omp_get_max_threads();
+#else
+	size_t threads = 1;
+#endif
+	for (size_t i = 0; i < threads; ++i) {
+		if (rngs[i] != other.rngs[i]) return "state of random generator " + std::to_string(i);
+	}
+
+	// Slot by slot, so that reported difference is the same no matter how maps are ordered
+	for (size_t x = 0; x < settings.fieldW; ++x) {
+		for (size_t y = 0; y < settings.fieldH; ++y) {
+			auto idx = Point(y, x).toArrayIdx();
+			auto where = [x, y]() { return " at (" + std::to_string(x) + ", " + std::to_string(y) + ")"; };
+			auto cell = cellsField[idx];
+			auto otherCell = other.cellsField[idx];
+			if (!cell != !otherCell) return "cell" + where() + " only exists in " + (cell ? "first" : "second") + " world";
+			if (cell) {
+				if (auto diff = cell->compareState(*otherCell)) return "cell" + where() + ": " + *diff;
+			}
+			if (energyPlane[idx] != other.energyPlane[idx]) return pair(("energy plane" + where()).c_str(), energyPlane[idx], other.energyPlane[idx]);
+			if (powerPlane[idx] != other.powerPlane[idx]) return pair(("power plane" + where()).c_str(), powerPlane[idx], other.powerPlane[idx]);
+			if (shadowMap[idx] != other.shadowMap[idx]) return pair(("shadow" + where()).c_str(), shadowMap[idx], other.shadowMap[idx]);
+		}
+	}
+	return std::nullopt;
+}
+
+static constexpr char checkpointMagic[8] = {'C', 'S', 'C', 'H', 'E', 'C', 'K', 'P'};
+static constexpr uint32_t checkpointVersion = 1;
+
+void World::saveCheckpoint(std::ostream& out) const {
+	out.write(checkpointMagic, sizeof(checkpointMagic));
+	writeLE(out, checkpointVersion);
+	writeLE<uint32_t>(out, settings.fieldW);
+	writeLE<uint32_t>(out, settings.fieldH);
+	writeLE<uint64_t>(out, tickCount);
+	writeLE(out, nextCellId);
+
+	// Generators only have textual serialization in standard
+#ifdef WITH_OPENMP
+	size_t threads = omp_get_max_threads();
+#else
+	size_t threads = 1;
+#endif
+	writeLE<uint32_t>(out, threads);
+	for (size_t i = 0; i < threads; ++i) {
+		std::ostringstream state;
+		state << rngs[i];
+		writeLE<uint64_t>(out, std::stoull(state.str()));
+	}
+
+	writeLE<uint64_t>(out, cellsMap.size());
+	for (const auto& pair : cellsMap) {
+		writeLE<uint32_t>(out, pair.first.x);
+		writeLE<uint32_t>(out, pair.first.y);
+		pair.second->save(out);
+	}
+	if (!out) throw std::runtime_error("Failed writing checkpoint");
+}
+
+void World::loadCheckpoint(std::istream& in) {
+	char magic[sizeof(checkpointMagic)];
+	if (!in.read(magic, sizeof(magic)) or !std::equal(magic, magic + sizeof(magic), checkpointMagic)) {
+		throw std::runtime_error("Not a checkpoint");
+	}
+	if (readLE<uint32_t>(in) != checkpointVersion) throw std::runtime_error("Unsupported checkpoint version");
+	auto fieldW = readLE<uint32_t>(in);
+	auto fieldH = readLE<uint32_t>(in);
+	if (fieldW != settings.fieldW or fieldH != settings.fieldH) {
+		throw std::runtime_error("Checkpoint is for " + std::to_string(fieldW) + "x" + std::to_string(fieldH) + " world");
+	}
+	auto newTickCount = readLE<uint64_t>(in);
+	auto newNextCellId = readLE<uint64_t>(in);
+
+	// With different amount of threads, extra generators keep their current state
+#ifdef WITH_OPENMP
+	size_t threads = omp_get_max_threads();
+#else
+	size_t threads = 1;
+#endif
+	size_t savedThreads = readLE<uint32_t>(in);
+	std::vector<uint64_t> rngStates(savedThreads);
+	for (auto& state : rngStates) {
+		state = readLE<uint64_t>(in);
+	}
+
+	// Parse everything before touching current state
+	size_t cnt = readLE<uint64_t>(in);
+	std::vector<std::pair<Point, std::unique_ptr<Cell>>> cells;
+	for (size_t i = 0; i < cnt; ++i) {
+		size_t x = readLE<uint32_t>(in);
+		size_t y = readLE<uint32_t>(in);
+		if (x >= fieldW or y >= fieldH) throw std::runtime_error("Cell is out of bounds in checkpoint");
+		auto cell = Cell::load(in);
+		if (cell->getId() >= newNextCellId) throw std::runtime_error("Cell ID is out of range in checkpoint");
+		cells.emplace_back(Point(y, x), std::move(cell));
+	}
+	{
+		std::vector<size_t> slots;
+		slots.reserve(cells.size());
+		for (const auto& pair : cells) {
+			slots.push_back(pair.first.toArrayIdx());
+		}
+		std::sort(slots.begin(), slots.end());
+		if (std::adjacent_find(slots.begin(), slots.end()) != slots.end()) throw std::runtime_error("Two cells share a slot in checkpoint");
+	}
+
+	for (const auto& pair : cellsMap) {
+		census.remove(pair.second->getGenomeHash());
+		setFieldCell(pair.first, nullptr);
+	}
+	cellsMap.clear();
+	for (auto& pair : cells) {
+		census.add(pair.second->getGenomeHash(), newTickCount);
+		setFieldCell(pair.first, pair.second.get());
+		cellsMap.emplace(pair.first, std::move(pair.second));
+	}
+
+	for (size_t i = 0; i < std::min(threads, savedThreads); ++i) {
+		rngs[i].seed(rngStates[i]);
+	}
+	tickCount = newTickCount;
+	nextCellId = newNextCellId;
+	noiseEpoch = tickCount / 256;
+	std::fill_n(dirtyColumns.get(), settings.fieldW, 1);
+}
+
+template<typename Geometry>
+void World::tickImpl() {
+	// OpenMP clauses can't name data members, so alias them
+	auto& cellsMap = this->cellsMap;
+	auto& moves = this->moves;
+	auto& energyts = this->energyts;
+	auto& eats = this->eats;
+	auto& divisions = this->divisions;
+	auto& todie = this->todie;
+	// Note: must not be used in tasks. Each must get an individual copy instead.
+	auto& rng = threadRng();
+
+	// Round 1 of calculations: poll cells for actions
+
+#ifdef WITH_OPENMP
+	#pragma omp sections
+#endif
+	{
+#ifdef WITH_OPENMP
+		#pragma omp section
+#endif
+		moves.clear();
+#ifdef WITH_OPENMP
+		#pragma omp section
+#endif
+		energyts.clear();
+#ifdef WITH_OPENMP
+		#pragma omp section
+#endif
+		eats.clear();
+		// Cells might look for others during round 1, so catch up on everything that happened since last sweep
+#ifdef WITH_OPENMP
+		#pragma omp section
+#endif
+		spatialIndex.update<Geometry>();
+	}
+
+#ifdef WITH_OPENMP
+	#pragma omp single
+#endif
+	{
+		// Parked cells are handled entirely by advanceEnd()
+		parkedCells = 0;
+		auto skipParked = [this](const Point& pos) {
+			auto idx = pos.toArrayIdx<Geometry>();
+			if (!parkedPlane[idx]) return false;
+			if (!fastForward) {
+				cellsField[idx]->unpark();
+				parkedPlane[idx] = 0;
+				return false;
+			}
+			++parkedCells;
+			return true;
+		};
+
+		for (auto& pair : cellsMap) {
+			if (skipParked(pair.first)) continue;
+
+#ifdef WITH_OPENMP
+			#pragma omp task shared(pair) shared(moves, energyts, eats) default(none)
+#endif
+			{
+				auto res = pair.second->advanceBegin<Geometry>(pair.first);
+				if (res) {
+					switch (res->type) {
+					case CellActionRequestType::MOVE:
+#ifdef WITH_OPENMP
+						#pragma omp critical(moves)
+#endif
+						moves.emplace_back(pair.first, pair.second.get());
+						break;
+					case CellActionRequestType::ENERGY:
+#ifdef WITH_OPENMP
+						#pragma omp critical(energyts)
+#endif
+						energyts.emplace_back(pair.first, res);
+						break;
+					case CellActionRequestType::EAT:
+#ifdef WITH_OPENMP
+						#pragma omp critical(eats)
+#endif
+						eats.emplace_back(pair.first, res);
+						break;
+
+					case CellActionRequestType::NONE:
+						abort(); // Something is wrong
+						break;
+					}
+				}
+			}
+		}
+#ifdef WITH_OPENMP
+		#pragma omp taskwait
+#endif
+	}
+
+#ifdef WITH_OPENMP
+	#pragma omp single
+#endif
+	{
+		// Round two: handle energy transfers, eating and movement
+		// This includes changing state of cells, so we do this single-threaded (sadly)
+		// TODO: shuffling vectors first might be a good idea
+		counters = {};
+
+		// Energy transfers don't invalidate anything
+		for (auto& req : energyts) {
+			const auto second = req.second;
+			req.first.checkBounds<Geometry>();
+			if (!req.first.apply<Geometry>(second->dir)) abort();
+			cellsField[req.first.toArrayIdx<Geometry>()]->addEnergy(second->num);
+			second->res = 1;
+		}
+
+		// Eating requests might destroy source or target cells, so check for them first
+		for (auto& req : eats) {
+			req.first.checkBounds<Geometry>();
+			// Are we still there?
+			auto eater = cellsField[req.first.toArrayIdx<Geometry>()];
+			if (eater) {
+				const auto second = req.second;
+				if (!req.first.apply<Geometry>(second->dir)) abort();
+
+				// Is our eating target still there?
+				auto prey = cellsField[req.first.toArrayIdx<Geometry>()];
+				if (prey) {
+					// It is. Good
+					bool canEat = false;
+
+					auto getPotential = [](decltype(eater)& obj) {
+						return obj->getEnergy() + obj->getPower();
+					};
+
+					auto eaterPotential = getPotential(eater);
+					auto preyPotential = getPotential(prey);
+
+					if (eaterPotential < preyPotential) {
+						uint8_t diff = preyPotential - eaterPotential;
+
+						std::uniform_int_distribution<uint8_t> dist(0, diff);
+						// This affects how useful eating is in general
+						canEat = dist(rng) < 25;
+					} else {
+						canEat = true;
+					}
+					second->res = canEat;
+
+					if (canEat) {
+						// We ate 'em!
+						// Add from half to all of their energy to us and erase them
+						//std::cout << "Om nom nom\n";
+						std::uniform_int_distribution<uint8_t> dist(prey->getEnergy() / 2, prey->getEnergy());
+						eater->addEnergy(dist(rng));
+						++counters.eats;
+						census.remove(prey->getGenomeHash());
+						if (lineage) lineage->death(tickCount, prey->getId(), DeathCause::EATEN, prey->getAge(), req.first);
+						cellsMap.erase(req.first);
+						setFieldCell<Geometry>(req.first, nullptr);
+					}
+				} else {
+					second->res = 0;
+				}
+				// No outer else needed, the eater is gone by now
+			}
+		}
+
+		// Now movement requests
+		// Check both for existance of asker and possiblity of request
+		// Also note that movement invalidates action pointers of moved cells, so be extra careful
+		for (auto& reqPair : moves) {
+			// Are we still there? Is that still really us?
+			auto cell = reqPair.second;
+			auto posIdx = reqPair.first.toArrayIdx<Geometry>();
+			if (cellsField[posIdx] and cellsField[posIdx] == cell) {
+				const auto req = cell->getActionPtr();
+				const auto origPos = reqPair.first;
+				if (!reqPair.first.apply<Geometry>(req->dir)) abort();
+				// Ensure that target space is empty
+				if (!cellsField[reqPair.first.toArrayIdx<Geometry>()]) {
+					req->res = 1;
+					++counters.moves;
+					reqPair.first.checkBounds<Geometry>();
+					cellsMap.emplace(reqPair.first, std::move(cellsMap.at(origPos)));
+					cellsMap.erase(origPos);
+					setFieldCell<Geometry>(reqPair.first, cell);
+					setFieldCell<Geometry>(origPos, nullptr);
+				} else {
+					req->res = 0;
+				}
+			}
+		}
+
+		{
+			size_t daytime = tickCount % 256;
+			if (daytime < 128) maxLight = 255 - daytime;
+			else maxLight = daytime;
+		}
+		// New day, new shadows
+		if (tickCount / 256 != noiseEpoch) {
+			noiseEpoch = tickCount / 256;
+			std::fill_n(dirtyColumns.get(), Geometry::width(), 1);
+		}
+	}
+	// Implicit OpenMP barrier
+
+	// Calculate lighting and finish calculations in cells, all in one sweep over the world
+	// Light level is `maxLight` minus accumulated shadow (see GlobalFieldType::light()), and shadow of a column
+	// only depends on its occupancy and noise which is fixed for the whole day. So only changed columns are redone,
+	// and cells of a column are finished right after it while its shadow is still in cache. Walking slots in memory
+	// order is also cheaper than walking cellsMap and leaves divisions and deaths sorted by position.
+	// Level 0 of spatial index is recounted on the way. Renderer only reads packed planes of the visible part, so it's left out.
+	{
+#ifdef WITH_OPENMP
+		#pragma omp sections
+#endif
+		{
+#ifdef WITH_OPENMP
+			#pragma omp section
+#endif
+			divisions.clear();
+#ifdef WITH_OPENMP
+			#pragma omp section
+#endif
+			todie.clear();
+		}
+
+		// Totals are summed per thread and added up once
+		size_t sweepEnergy = 0, sweepPower = 0;
+		// Chunks are whole tile columns of spatial index, so that every tile is recounted by one thread
+#ifdef WITH_OPENMP
+		#pragma omp for schedule(dynamic, SpatialIndex::tileSide) nowait
+#endif
+		for (size_t x = 0; x < Geometry::width(); ++x) {
+			if (x % SpatialIndex::tileSide == 0) spatialIndex.beginRecount(x / SpatialIndex::tileSide);
+			if (dirtyColumns[x]) {
+				dirtyColumns[x] = 0;
+
+				size_t shadow = 0;
+				size_t y = 0;
+				for (; y < Geometry::height() and shadow < 255; ++y) {
+					shadowMap[Point(y, x).toArrayIdx<Geometry>()] = shadow;
+					// TODO: make shadow proportional to cell's power
+					size_t change = (cellsField[Point(y, x).toArrayIdx<Geometry>()] ? 6 : 3) + shadowNoise(x, y, noiseEpoch);
+					shadow += change;
+				};
+				// Nothing is going to get through anymore
+				for (; y < Geometry::height(); ++y) {
+					shadowMap[Point(y, x).toArrayIdx<Geometry>()] = 255;
+				}
+			}
+
+			for (size_t y = 0; y < Geometry::height(); ++y) {
+				Point pos(y, x);
+				Cell* cell = cellsField[pos.toArrayIdx<Geometry>()];
+				if (!cell) continue;
+
+				auto res = cell->advanceEnd<Geometry>(pos, rng, fastForward);
+				updatePlanes<Geometry>(pos, cell);
+				spatialIndex.recount(pos, cell->getEnergy());
+				sweepEnergy += cell->getEnergy();
+				sweepPower += cell->getPower();
+				switch (res) {
+				case EndMoveAction::DIVIDE:
+#ifdef WITH_OPENMP
+					#pragma omp critical(divisions)
+#endif
+					divisions.push_back(pos);
+					break;
+				case EndMoveAction::DIE_STARVED:
+#ifdef WITH_OPENMP
+					#pragma omp critical(todie)
+#endif
+					todie.emplace_back(pos, DeathCause::STARVED);
+					break;
+				case EndMoveAction::DIE_OLD:
+#ifdef WITH_OPENMP
+					#pragma omp critical(todie)
+#endif
+					todie.emplace_back(pos, DeathCause::OLD_AGE);
+					break;
+				case EndMoveAction::NONE:
+					break;
+				};
+			}
+		}
+#ifdef WITH_OPENMP
+		#pragma omp atomic
+#endif
+		counters.totalEnergy += sweepEnergy;
+#ifdef WITH_OPENMP
+		#pragma omp atomic
+#endif
+		counters.totalPower += sweepPower;
+#ifdef WITH_OPENMP
+		#pragma omp barrier
+#endif
+
+#ifdef WITH_OPENMP
+		#pragma omp single
+#endif
+		{
+			// Deaths are still single-threaded, but they're cheap compared to divisions
+			counters.deaths = todie.size();
+			for (auto& death : todie) {
+				// It's an easy one
+				const Point& pos = death.first;
+				auto cell = cellsField[pos.toArrayIdx<Geometry>()];
+				census.remove(cell->getGenomeHash());
+				if (lineage) lineage->death(tickCount, cell->getId(), death.second, cell->getAge(), pos);
+				cellsMap.erase(pos);
+				setFieldCell<Geometry>(pos, nullptr);
+			}
+
+			// Divisions are done in two steps. First, in parallel, every parent picks a random empty neighbour, claims it
+			// and makes its child. Lowest index wins a contested slot and divisions are sorted by position, so outcome
+			// doesn't depend on timing. Then children are placed in order, losers of claims taking another slot if any is left.
+#ifdef WITH_OPENMP
+			// Sweep leaves them sorted already, unless columns were split between threads
+			std::sort(divisions.begin(), divisions.end(), [](const Point& a, const Point& b) {
+				return a.toArrayIdx<Geometry>() < b.toArrayIdx<Geometry>();
+			});
+#endif
+			births.clear();
+			births.resize(divisions.size());
+			// Drawn in separate statements, order of evaluation of operands is unspecified
+			const uint64_t seedHi = rng();
+			const uint64_t seedLo = rng();
+			birthSeed = (seedHi << 32) ^ seedLo;
+			// IDs of children that don't make it are never used
+			birthBaseId = nextCellId;
+			nextCellId += divisions.size();
+		}
+		// Implicit barrier
+
+		{
+			auto& divisions = this->divisions;
+			const auto seed = birthSeed;
+			const auto baseId = birthBaseId;
+#ifdef WITH_OPENMP
+			#pragma omp for schedule(dynamic, 64)
+#endif
+			for (size_t i = 0; i < divisions.size(); ++i) {
+				planBirth<Geometry>(i, seed, baseId + i);
+			}
+		}
+		// Implicit barrier
+
+#ifdef WITH_OPENMP
+		#pragma omp single
+#endif
+		{
+			auto limit = populationLimit();
+			cellsMap.reserve(std::min(cellsMap.size() + births.size(), limit));
+			for (size_t i = 0; i < births.size(); ++i) {
+				auto& birth = births[i];
+				// If we can't divide, we just silently loose energy
+				if (!birth.target) continue;
+
+				std::optional<Point> target = birth.target;
+				auto& claim = birthClaims[target->toArrayIdx<Geometry>()];
+				if (claim.load(std::memory_order_relaxed) == i) {
+					claim.store(noClaim, std::memory_order_relaxed);
+				} else {
+					// Lost the claim, so try a slot no pending birth wants
+					target = pickBirthSlot<Geometry>(divisions[i], birth.rng, true);
+					if (!target) continue;
+				}
+				// Same goes for being over population or memory ceiling
+				if (!admitBirth(limit, rng)) {
+					++throttledBirths;
+					continue;
+				}
+
+				auto parent = cellsField[divisions[i].toArrayIdx<Geometry>()];
+				auto& child = birth.child;
+				census.add(child->getGenomeHash(), tickCount);
+				if (lineage) lineage->birth(tickCount, child->getId(), parent->getId(), *target, birth.mutations);
+				setFieldCell<Geometry>(*target, child.get());
+				cellsMap.emplace(*target, std::move(child));
+				++counters.births;
+			}
+			// Children of failed divisions go away here
+			births.clear();
+
+			lastTick = counters;
+			if (telemetry) {
+				Telemetry::Sample sample {};
+				sample[Telemetry::POPULATION] = cellsMap.size();
+				sample[Telemetry::ENERGY] = counters.totalEnergy;
+				sample[Telemetry::POWER] = counters.totalPower;
+				sample[Telemetry::BIRTHS] = counters.births;
+				sample[Telemetry::DEATHS] = counters.deaths;
+				sample[Telemetry::EATS] = counters.eats;
+				sample[Telemetry::MOVES] = counters.moves;
+				telemetry->record(tickCount, sample);
+			}
+			++tickCount;
+		}
+		// Implicit barrier
+	}
+}
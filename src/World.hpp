@@ -0,0 +1,215 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Global.hpp"
+#include "Cell.hpp"
+#include "Census.hpp"
+#include "Lineage.hpp"
+#include "Seeding.hpp"
+#include "SpatialIndex.hpp"
+#include "Telemetry.hpp"
+
+struct WorldStats {
+	size_t population = 0;
+	size_t totalEnergy = 0;
+	size_t totalPower = 0;
+};
+
+// What happened during a single tick, gathered while it runs
+struct TickCounters {
+	size_t births = 0;
+	// Starved or died of old age, eaten cells are counted by `eats`
+	size_t deaths = 0;
+	size_t eats = 0;
+	size_t moves = 0;
+	// Of cells alive after movement, before deaths and births of the tick
+	size_t totalEnergy = 0;
+	size_t totalPower = 0;
+};
+
+// Estimated heap usage of a world by subsystem, in bytes
+struct MemoryUsage {
+	// Cell objects, not counting their programs
+	size_t cells = 0;
+	// Programs and census
+	size_t genomes = 0;
+	// Position to cell map
+	size_t index = 0;
+	// Per-slot maps: field, planes and shadow map
+	size_t grids = 0;
+	// Request and division vectors that are reused every tick
+	size_t buffers = 0;
+
+	size_t total() const { return cells + genomes + index + grids + buffers; };
+};
+
+// Everything needed to simulate one world
+// Any number of worlds may exist in one process, but each thread only works on one at a time (see bind())
+class World {
+	public:
+		World(size_t fieldW, size_t fieldH, uint_fast32_t seed);
+		World(const World&) = delete;
+		World& operator=(const World&) = delete;
+
+		// Make this world current for calling thread
+		// Every thread touching the world (including OpenMP workers) must call this first
+		void bind();
+
+		// Advance simulation by one tick
+		// With OpenMP it must be called by every thread of the team
+		void tick();
+
+		// Place cells with empty programs in random places
+		void spawnRandomCells(size_t cnt);
+		// Fill empty slots according to spec, returns amount of placed cells
+		// Runs in parallel with OpenMP, columns are independent so result doesn't depend on how they're split.
+		// Must not be called by a team.
+		size_t seedPopulation(const SeedSpec& spec);
+		// Representatives of up to `limit` most numerous strains, with their energy and registers
+		std::vector<GenomeBankEntry> exportGenomes(size_t limit) const;
+
+		// Random generator for calling thread
+		randomGenerator& threadRng();
+
+		WorldStats collectStats() const;
+		// Cheap enough to call every tick, doesn't look at individual cells
+		MemoryUsage memoryUsage() const;
+		// Most cells world is allowed to have right now according to caps below, SIZE_MAX if there are none
+		size_t populationLimit() const;
+		// Counters of last tick, unlike collectStats() it costs nothing
+		const TickCounters& getLastTick() const { return lastTick; };
+		// Divisions turned down because of caps so far
+		size_t getThrottledBirths() const { return throttledBirths; };
+		// Cells in closed loops that were fast-forwarded during last tick (see Cell::isParked())
+		size_t getParkedCells() const { return parkedCells; };
+
+		// Whole simulation state, including random generators. Settings like mutationRate aren't included.
+		void saveCheckpoint(std::ostream& out) const;
+		// Replaces current state. World must be of the same size. Throws on malformed or mismatching input.
+		void loadCheckpoint(std::istream& in);
+
+		// Describe first difference in state from `other`, which must be of the same size, or return nothing if
+		// worlds are identical. Derived data (planes, shadows) is compared too. Meant for checking fast paths against reference.
+		std::optional<std::string> compareState(const World& other) const;
+
+		// Switch tick to kernels for arbitrary field size instead of ones specialized for world's geometry.
+		// Slower, but gives reference to check specialized kernels against.
+		void useGenericKernels();
+
+		// Strains of living cells, always up to date between ticks
+		const Census& getCensus() const { return census; };
+
+		const GlobalSettingsType& getSettings() const { return settings; };
+		size_t getTickCount() const { return tickCount; };
+
+		// Various variables that affect how simulation is working
+		size_t mutationRate = 10;
+		// Let cells stuck in closed loops skip interpretation. Results are the same either way.
+		bool fastForward = true;
+		// Population and memory ceilings (in cells and bytes), 0 means no limit
+		// Births get rarer as population approaches a ceiling and stop at it, the same goes for spawning and seeding.
+		size_t populationCap = 0;
+		size_t memoryCap = 0;
+		// Births and deaths are recorded here if set
+		std::shared_ptr<LineageLog> lineage;
+		// Counters of every tick are recorded here if set
+		std::shared_ptr<Telemetry> telemetry;
+	private:
+		GlobalSettingsType settings;
+
+		std::unordered_map<Point, std::unique_ptr<Cell>> cellsMap;
+		std::unique_ptr<Cell*[]> cellsField;
+		// Packed copies of cells' energy and power for renderer, empty slots are 0
+		std::unique_ptr<uint8_t[]> energyPlane;
+		std::unique_ptr<uint8_t[]> powerPlane;
+		// Set for slots of parked cells, so that round 1 can skip them without touching cells themselves
+		std::unique_ptr<uint8_t[]> parkedPlane;
+		// Accumulated shadow, saturated at 255. Only columns marked as dirty are recalculated each tick.
+		// Note: shadow map is stored column-by-column to optimize memory access
+		std::unique_ptr<uint8_t[]> shadowMap;
+		std::unique_ptr<uint8_t[]> dirtyColumns;
+		SpatialIndex spatialIndex;
+		uint8_t maxLight = 255;
+		// Shadow noise changes once a day
+		size_t noiseEpoch = 0;
+
+		// All changes to cellsField must go through here to keep derived data up to date
+		template<typename Geometry = DynamicGeometry>
+		void setFieldCell(const Point& pos, Cell* cell) {
+			cellsField[pos.toArrayIdx<Geometry>()] = cell;
+			dirtyColumns[pos.x] = 1;
+			spatialIndex.markDirty(pos);
+			updatePlanes<Geometry>(pos, cell);
+		};
+		// Must also be called after cell's energy or power is changed
+		template<typename Geometry = DynamicGeometry>
+		void updatePlanes(const Point& pos, const Cell* cell) {
+			auto idx = pos.toArrayIdx<Geometry>();
+			energyPlane[idx] = cell ? cell->getEnergy() : 0;
+			powerPlane[idx] = cell ? cell->getPower() : 0;
+			parkedPlane[idx] = cell ? cell->isParked() : 0;
+		};
+
+		// One per thread
+		std::unique_ptr<randomGenerator[]> rngs;
+
+		size_t tickCount = 0;
+		uint64_t nextCellId = 1;
+		Census census;
+		size_t throttledBirths = 0;
+		// Filled during tick, becomes lastTick at its end
+		TickCounters counters;
+		TickCounters lastTick;
+		// Counted while scheduling round 1
+		size_t parkedCells = 0;
+
+		// Whether a division should go ahead with `limit` being populationLimit() as of this tick
+		bool admitBirth(size_t limit, randomGenerator& rng);
+
+		// Specialized for world's geometry, picked once on creation
+		template<typename Geometry>
+		void tickImpl();
+		void (World::*tickFn)();
+
+		// Those vectors get reused a lot, so don't create them every tick
+		std::vector<std::pair<Point, Cell*>> moves;
+		std::vector<std::pair<Point, CellActionRequest*>> energyts;
+		std::vector<std::pair<Point, CellActionRequest*>> eats;
+
+		std::vector<Point> divisions;
+		std::vector<std::pair<Point, DeathCause>> todie;
+
+		// Division in progress, one per entry of `divisions`
+		struct Birth {
+			// Slot claimed by parent, unset if it was boxed in
+			std::optional<Point> target;
+			std::unique_ptr<Cell> child;
+			// Bytes of child's program that differ from parent's
+			size_t mutations;
+			// Seeded from parent's ID, so it doesn't matter which thread planned the birth
+			randomGenerator rng;
+		};
+		std::vector<Birth> births;
+		// Lowest index of birth that wants the slot, or noClaim. Every claim is cleared by the time tick ends.
+		static constexpr uint32_t noClaim = UINT32_MAX;
+		std::unique_ptr<std::atomic<uint32_t>[]> birthClaims;
+		// Picked by thread doing the serial part of tick for the parallel one
+		uint64_t birthSeed = 0;
+		uint64_t birthBaseId = 0;
+
+		// Random empty neighbour of `pos`, optionally skipping slots claimed by pending births
+		template<typename Geometry>
+		std::optional<Point> pickBirthSlot(const Point& pos, randomGenerator& rng, bool unclaimedOnly) const;
+		// Pick and claim a slot for division `i` and create its child, can run in parallel for different divisions
+		template<typename Geometry>
+		void planBirth(size_t i, uint64_t seed, uint64_t childId);
+};